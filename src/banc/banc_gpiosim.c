@@ -0,0 +1,302 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Banc d'essai des pilotes du clavier sur une puce gpio-sim
+*
+* Ce programme remplace le clavier matriciel physique. Il est lancé par
+* banc_gpiosim.sh une fois le pilote chargé sur une puce gpio-sim, et :
+*
+*   - simule la matrice : un thread observe en continu les lignes pilotées
+*     par le module (sim_gpioN/value) et ajuste les colonnes (sim_gpioN/pull)
+*     en fonction des touches enfoncées;
+*   - injecte une séquence de pressions et de relâchements;
+*   - lit /dev/setrclavier et compare les caractères reçus à ceux injectés.
+*
+* Il affiche ensuite le débit, les touches perdues et en double, la latence
+* entre la pression et la lecture, ainsi que le temps CPU des threads du pilote.
+*
+* Usage : banc_gpiosim <répertoire sysfs de la puce> <mode du pilote>
+*                      [nombreTouches] [pressionMs] [intervalleMs]
+*
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+#define FICHIER_CLAVIER "/dev/setrclavier"
+
+// Doit correspondre aux paramètres gpiosLignes, gpiosColonnes et touches du pilote (valeurs par défaut)
+#define NOMBRE_LIGNES 4
+#define NOMBRE_COLONNES 3
+static const int gpiosLignes[NOMBRE_LIGNES] = {5, 6, 13, 19};
+static const int gpiosColonnes[NOMBRE_COLONNES] = {12, 16, 20};
+static const char valeursClavier[NOMBRE_LIGNES][NOMBRE_COLONNES] = {
+    {'1', '2', '3'},
+    {'4', '5', '6'},
+    {'7', '8', '9'},
+    {'*', '0', '#'}
+};
+
+// Une touche injectée, et le moment où elle a été lue (0 : pas encore lue)
+struct injection {
+    char caractere;
+    int64_t pressionNs;
+    int64_t lectureNs;
+};
+
+static struct injection *injections;
+static int nombreInjectees = 0;         // Protégé par verrouInjections
+static int prochaineAttendue = 0;       // Première injection pas encore appariée
+static int perdues = 0, doublons = 0, lues = 0;
+static pthread_mutex_t verrouInjections = PTHREAD_MUTEX_INITIALIZER;
+
+static _Atomic uint64_t touchesEnfoncees = 0;   // Un bit par touche : ligne * 8 + colonne
+static atomic_int arret = 0;
+
+static int64_t maintenantNs(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void dormirMs(int ms){
+    struct timespec ts = { ms / 1000, (ms % 1000) * 1000000L };
+
+    while(nanosleep(&ts, &ts) && errno == EINTR);
+}
+
+static int ouvrirSim(const char *repertoire, int gpio, const char *attribut, int mode){
+    char chemin[512];
+    int fd;
+
+    snprintf(chemin, sizeof(chemin), "%s/sim_gpio%d/%s", repertoire, gpio, attribut);
+    fd = open(chemin, mode);
+    if(fd < 0){
+        perror(chemin);
+        exit(1);
+    }
+    return fd;
+}
+
+// Simule la matrice : une colonne est active si une touche enfoncée se trouve sur
+// une ligne présentement active. Le thread ne dort jamais, pour réagir le plus vite
+// possible aux changements de ligne : il occupe un coeur pendant toute la mesure.
+static void *simulerMatrice(void *arg){
+    const char *repertoire = arg;
+    int fdLignes[NOMBRE_LIGNES], fdColonnes[NOMBRE_COLONNES];
+    int etatColonnes[NOMBRE_COLONNES];
+    int ligne, colonne, actives;
+    uint64_t touches;
+    char valeur[4];
+
+    for(ligne = 0; ligne < NOMBRE_LIGNES; ligne++)
+        fdLignes[ligne] = ouvrirSim(repertoire, gpiosLignes[ligne], "value", O_RDONLY);
+    for(colonne = 0; colonne < NOMBRE_COLONNES; colonne++){
+        fdColonnes[colonne] = ouvrirSim(repertoire, gpiosColonnes[colonne], "pull", O_WRONLY);
+        pwrite(fdColonnes[colonne], "pull-down", 9, 0);
+        etatColonnes[colonne] = 0;
+    }
+
+    while(!atomic_load(&arret)){
+        touches = atomic_load(&touchesEnfoncees);
+        actives = 0;
+        for(ligne = 0; ligne < NOMBRE_LIGNES; ligne++){
+            if(pread(fdLignes[ligne], valeur, sizeof(valeur), 0) > 0 && valeur[0] == '1')
+                actives |= (touches >> (ligne * 8)) & ((1 << NOMBRE_COLONNES) - 1);
+        }
+        for(colonne = 0; colonne < NOMBRE_COLONNES; colonne++){
+            if(((actives >> colonne) & 1) == etatColonnes[colonne])
+                continue;
+            etatColonnes[colonne] = !etatColonnes[colonne];
+            if(etatColonnes[colonne])
+                pwrite(fdColonnes[colonne], "pull-up", 7, 0);
+            else
+                pwrite(fdColonnes[colonne], "pull-down", 9, 0);
+        }
+    }
+
+    for(colonne = 0; colonne < NOMBRE_COLONNES; colonne++){
+        pwrite(fdColonnes[colonne], "pull-down", 9, 0);
+        close(fdColonnes[colonne]);
+    }
+    for(ligne = 0; ligne < NOMBRE_LIGNES; ligne++)
+        close(fdLignes[ligne]);
+    return NULL;
+}
+
+// Apparie chaque caractère lu à la plus ancienne injection correspondante.
+// Les injections sautées sont perdues; un caractère sans injection est un doublon.
+static void apparier(char caractere, int64_t instantNs){
+    int i;
+
+    pthread_mutex_lock(&verrouInjections);
+    for(i = prochaineAttendue; i < nombreInjectees; i++)
+        if(injections[i].caractere == caractere)
+            break;
+    if(i < nombreInjectees){
+        perdues += i - prochaineAttendue;
+        injections[i].lectureNs = instantNs;
+        prochaineAttendue = i + 1;
+        lues++;
+    }
+    else{
+        doublons++;
+    }
+    pthread_mutex_unlock(&verrouInjections);
+}
+
+static void *lireClavier(void *arg){
+    int fd = *(int *)arg;
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    char buffer[256];
+    ssize_t n, i;
+    int64_t instant;
+
+    while(!atomic_load(&arret)){
+        if(poll(&pfd, 1, 100) <= 0)
+            continue;
+        n = read(fd, buffer, sizeof(buffer));
+        instant = maintenantNs();
+        for(i = 0; i < n; i++)
+            apparier(buffer[i], instant);
+    }
+    return NULL;
+}
+
+// Temps CPU (en ticks) des threads noyau du pilote : le thread de polling (modes
+// polling et hybrid) et les threads d'IRQ (mode irq)
+static long long tempsCpuPilote(void){
+    DIR *proc = opendir("/proc");
+    struct dirent *entree;
+    char chemin[288], ligne[512], *fin;
+    long long total = 0, utime, stime;
+    FILE *f;
+
+    if(!proc)
+        return 0;
+    while((entree = readdir(proc))){
+        if(entree->d_name[0] < '0' || entree->d_name[0] > '9')
+            continue;
+        snprintf(chemin, sizeof(chemin), "/proc/%s/stat", entree->d_name);
+        f = fopen(chemin, "r");
+        if(!f)
+            continue;
+        if(fgets(ligne, sizeof(ligne), f) &&
+                (strstr(ligne, "(Thread_polling") || strstr(ligne, "setr_irq"))){
+            // Les champs 14 et 15 (utime, stime) suivent le nom entre parenthèses
+            fin = strrchr(ligne, ')');
+            if(fin && sscanf(fin + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lld %lld",
+                             &utime, &stime) == 2)
+                total += utime + stime;
+        }
+        fclose(f);
+    }
+    closedir(proc);
+    return total;
+}
+
+static int comparerLatences(const void *a, const void *b){
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+int main(int argc, char *argv[]){
+    int nombreTouches = 200, pressionMs = 50, intervalleMs = 50;
+    pthread_t threadMatrice, threadLecture;
+    int64_t debutNs, finNs, *latences;
+    long long cpuAvant, cpuApres;
+    int fd, k, touche, nombreLatences = 0;
+    double dureeS;
+    char vidange[256];
+
+    if(argc < 3){
+        fprintf(stderr, "Usage : %s <repertoire sysfs gpio-sim> <mode> [nombreTouches] [pressionMs] [intervalleMs]\n", argv[0]);
+        return 1;
+    }
+    if(argc > 3) nombreTouches = atoi(argv[3]);
+    if(argc > 4) pressionMs = atoi(argv[4]);
+    if(argc > 5) intervalleMs = atoi(argv[5]);
+
+    injections = calloc(nombreTouches, sizeof(*injections));
+    latences = calloc(nombreTouches, sizeof(*latences));
+    fd = open(FICHIER_CLAVIER, O_RDONLY | O_NONBLOCK);
+    if(!injections || !latences || fd < 0){
+        perror(FICHIER_CLAVIER);
+        return 1;
+    }
+
+    pthread_create(&threadMatrice, NULL, simulerMatrice, argv[1]);
+    // On laisse la matrice se stabiliser, puis on vide ce qui a pu être lu entre-temps
+    dormirMs(200);
+    while(read(fd, vidange, sizeof(vidange)) > 0);
+    pthread_create(&threadLecture, NULL, lireClavier, &fd);
+
+    cpuAvant = tempsCpuPilote();
+    debutNs = maintenantNs();
+    for(k = 0; k < nombreTouches; k++){
+        // Parcourt toutes les touches de la matrice, l'une après l'autre
+        touche = k % (NOMBRE_LIGNES * NOMBRE_COLONNES);
+        pthread_mutex_lock(&verrouInjections);
+        injections[k].caractere = valeursClavier[touche / NOMBRE_COLONNES][touche % NOMBRE_COLONNES];
+        injections[k].pressionNs = maintenantNs();
+        nombreInjectees++;
+        pthread_mutex_unlock(&verrouInjections);
+        atomic_fetch_or(&touchesEnfoncees, 1ULL << ((touche / NOMBRE_COLONNES) * 8 + touche % NOMBRE_COLONNES));
+        dormirMs(pressionMs);
+        atomic_store(&touchesEnfoncees, 0);
+        dormirMs(intervalleMs);
+    }
+    // Laisse au pilote le temps de rapporter les dernières touches (période de balayage maximale)
+    dormirMs(500);
+    finNs = maintenantNs();
+    cpuApres = tempsCpuPilote();
+
+    atomic_store(&arret, 1);
+    pthread_join(threadLecture, NULL);
+    pthread_join(threadMatrice, NULL);
+    close(fd);
+
+    perdues += nombreInjectees - prochaineAttendue;
+    for(k = 0; k < nombreInjectees; k++)
+        if(injections[k].lectureNs)
+            latences[nombreLatences++] = injections[k].lectureNs - injections[k].pressionNs;
+    qsort(latences, nombreLatences, sizeof(*latences), comparerLatences);
+    dureeS = (finNs - debutNs) / 1e9;
+
+    printf("mode                : %s\n", argv[2]);
+    printf("touches injectees   : %d (%d ms enfoncee, %d ms entre deux)\n", nombreInjectees, pressionMs, intervalleMs);
+    printf("touches lues        : %d\n", lues);
+    printf("debit               : %.1f touches/s\n", lues / dureeS);
+    printf("perdues             : %d\n", perdues);
+    printf("doublons            : %d\n", doublons);
+    if(nombreLatences){
+        long long somme = 0;
+        for(k = 0; k < nombreLatences; k++)
+            somme += latences[k];
+        printf("latence (us)        : moy %.1f, p50 %.1f, p99 %.1f, max %.1f\n",
+               somme / 1e3 / nombreLatences,
+               latences[nombreLatences / 2] / 1e3,
+               latences[(nombreLatences * 99) / 100] / 1e3,
+               latences[nombreLatences - 1] / 1e3);
+    }
+    printf("CPU threads pilote  : %.1f ms (%.2f %% d'un coeur)\n",
+           (cpuApres - cpuAvant) * 1e3 / sysconf(_SC_CLK_TCK),
+           (cpuApres - cpuAvant) * 100.0 / sysconf(_SC_CLK_TCK) / dureeS);
+
+    free(injections);
+    free(latences);
+    return perdues || doublons ? 2 : 0;
+}
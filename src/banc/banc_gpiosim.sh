@@ -0,0 +1,41 @@
+#!/bin/bash
+# Compare les modes de balayage de setr_driver (polling, irq et hybrid) sur une puce
+# gpio-sim, sans clavier physique.
+#
+# Prérequis : un noyau avec CONFIG_GPIO_SIM et configfs, les modules compilés pour
+# ce noyau (make hote) et le banc compilé (make banc). Doit être lancé en root :
+#
+#   sudo ./banc/banc_gpiosim.sh [nombreTouches] [pressionMs] [intervalleMs]
+#
+# Les arguments sont transmis tels quels à banc_gpiosim.
+set -e
+cd "$(dirname "$0")/.."
+
+PUCE=setr-sim                   # Étiquette de la puce, transmise aux pilotes (puceGpio)
+DELAI_US=${DELAI_US:-500}       # Laisse au simulateur le temps de suivre chaque ligne
+CONFIG=/sys/kernel/config/gpio-sim/setr
+
+nettoyer() {
+    rmmod setr_driver 2>/dev/null || true
+    if [ -d $CONFIG ]; then
+        echo 0 > $CONFIG/live
+        rmdir $CONFIG/bank0 $CONFIG
+    fi
+}
+trap nettoyer EXIT
+
+# Une puce de 32 lignes, pour que les numéros de GPIO de gpiosLignes et gpiosColonnes soient valides tels quels
+modprobe gpio-sim
+mkdir $CONFIG $CONFIG/bank0
+echo 32 > $CONFIG/bank0/num_lines
+echo $PUCE > $CONFIG/bank0/label
+echo 1 > $CONFIG/live
+SYSFS=/sys/devices/platform/$(cat $CONFIG/dev_name)/$(cat $CONFIG/bank0/chip_name)
+
+for mode in polling irq hybrid; do
+    insmod setr_driver.ko mode=$mode puceGpio=$PUCE delaiEtablissementUs=$DELAI_US
+    udevadm settle
+    ./banc/banc_gpiosim $SYSFS $mode "$@" || true
+    echo
+    rmmod setr_driver
+done
@@ -0,0 +1,199 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Banc d'essai du tampon de diffusion et de read(), par injection d'événements
+*
+* Ce programme n'a besoin d'aucun GPIO : il écrit des événements synthétiques
+* (struct setr_injection) dans /sys/kernel/debug/setrclavier/injecter (clavier 0,
+* ou setrclavierN/injecter pour le clavier N), qui
+* n'existe que si le module est chargé avec activerInjection=1, et :
+*
+*   - les lit en mode binaire avec un ou plusieurs lecteurs, chacun dans son
+*     propre thread et avec son propre descripteur de fichier;
+*   - vérifie que chaque lecteur reçoit les événements dans l'ordre de leurs
+*     numéros de séquence, et compte les trous, à comparer aux sauts rapportés
+*     par SETR_IOCTL_SAUTS (les événements ignorés par drop-newest laissent un
+*     trou sans saut; ceux écrasés avant la première lecture, un saut sans trou);
+*   - affiche le débit d'injection et de lecture, ainsi que le nombre de réveils
+*     (read() ayant retourné des événements) de chaque lecteur.
+*
+* Doit être lancé en root (debugfs). Compilé par "make injection".
+*
+* Usage : banc_injection [clavier] [evenements] [rafale] [lecteurs] [pauseUs]
+*
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/ioctl.h>
+
+#include "setr_clavier.h"
+
+#define MAX_LECTEURS 16
+#define ENTREES_PAR_ECRITURE 256    // struct setr_injection par write()
+#define EVENEMENTS_PAR_LECTURE 256  // struct setr_evenement par read()
+
+// Touches injectées à tour de rôle : doivent exister sur tous les claviers (3 colonnes au moins)
+#define NOMBRE_TOUCHES 3
+
+struct lecteur {
+    pthread_t thread;
+    int fd;
+    unsigned long recus, reveils, trous, desordres;
+    uint32_t sauts;
+    uint32_t prochaineSequence;
+    int premier;                // Aucun événement reçu : prochaineSequence n'est pas encore connue
+};
+
+static struct lecteur lecteurs[MAX_LECTEURS];
+static atomic_int arret = 0;
+
+static int64_t maintenantNs(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void nomClavier(char *nom, size_t taille, int clavier){
+    // Le clavier 0 s'appelle setrclavier, les suivants setrclavier1, setrclavier2, etc.
+    if(clavier)
+        snprintf(nom, taille, "setrclavier%d", clavier);
+    else
+        snprintf(nom, taille, "setrclavier");
+}
+
+static void *lireClavier(void *arg){
+    // Lit jusqu'à ce que l'injection soit terminée et que plus rien n'arrive pendant 100 ms
+    struct lecteur *lecteur = arg;
+    struct pollfd pfd = { .fd = lecteur->fd, .events = POLLIN };
+    struct setr_evenement evenements[EVENEMENTS_PAR_LECTURE];
+    uint32_t sauts;
+    int32_t ecart;
+    ssize_t n, i;
+
+    while(1){
+        if(poll(&pfd, 1, 100) <= 0){
+            if(atomic_load(&arret))
+                break;
+            continue;
+        }
+        n = read(lecteur->fd, evenements, sizeof(evenements));
+        if(n <= 0)
+            continue;
+        lecteur->reveils++;
+        n /= sizeof(struct setr_evenement);
+        for(i = 0; i < n; i++){
+            // Les numéros de séquence sont des compteurs libres de 32 bits : on compare leur écart
+            ecart = (int32_t)(evenements[i].sequence - lecteur->prochaineSequence);
+            if(!lecteur->premier && ecart > 0)
+                lecteur->trous += ecart;
+            else if(!lecteur->premier && ecart < 0)
+                lecteur->desordres++;
+            lecteur->premier = 0;
+            lecteur->prochaineSequence = evenements[i].sequence + 1;
+        }
+        lecteur->recus += n;
+    }
+    if(ioctl(lecteur->fd, SETR_IOCTL_SAUTS, &sauts) == 0)
+        lecteur->sauts += sauts;
+    return NULL;
+}
+
+int main(int argc, char *argv[]){
+    int clavier = 0, nombreLecteurs = 1;
+    long evenements = 1000000, rafale = 64, pauseUs = 0;
+    struct setr_injection entrees[ENTREES_PAR_ECRITURE];
+    char nom[32], chemin[64];
+    long injectes = 0, k, nombreEntrees;
+    int64_t debutNs, injectionNs, finNs;
+    int fdInjection, i, erreur = 0;
+    ssize_t ecrits;
+
+    if(argc > 1) clavier = atoi(argv[1]);
+    if(argc > 2) evenements = atol(argv[2]);
+    if(argc > 3) rafale = atol(argv[3]);
+    if(argc > 4) nombreLecteurs = atoi(argv[4]);
+    if(argc > 5) pauseUs = atol(argv[5]);
+    if(evenements <= 0 || rafale <= 0 || rafale > UINT32_MAX || nombreLecteurs < 0 ||
+       nombreLecteurs > MAX_LECTEURS || pauseUs < 0 || pauseUs > UINT32_MAX){
+        fprintf(stderr, "Usage : %s [clavier] [evenements] [rafale] [lecteurs (0 a %d)] [pauseUs]\n",
+                argv[0], MAX_LECTEURS);
+        return 1;
+    }
+
+    nomClavier(nom, sizeof(nom), clavier);
+    snprintf(chemin, sizeof(chemin), "/sys/kernel/debug/%s/injecter", nom);
+    fdInjection = open(chemin, O_WRONLY);
+    if(fdInjection < 0){
+        perror(chemin);
+        fprintf(stderr, "Le module doit etre charge avec activerInjection=1, et ce programme lance en root\n");
+        return 1;
+    }
+
+    // Les lecteurs ouvrent le clavier avant l'injection : ils en reçoivent donc tous les événements
+    snprintf(chemin, sizeof(chemin), "/dev/%s", nom);
+    for(i = 0; i < nombreLecteurs; i++){
+        lecteurs[i].fd = open(chemin, O_RDONLY);
+        if(lecteurs[i].fd < 0 || ioctl(lecteurs[i].fd, SETR_IOCTL_MODE_LECTURE, SETR_LECTURE_BINAIRE) < 0){
+            perror(chemin);
+            return 1;
+        }
+        lecteurs[i].premier = 1;
+        pthread_create(&lecteurs[i].thread, NULL, lireClavier, &lecteurs[i]);
+    }
+
+    // Chaque entrée est une rafale de pressions ou de relâchements d'une touche; les touches
+    // et les types alternent d'une entrée à l'autre
+    nombreEntrees = 0;
+    debutNs = maintenantNs();
+    while(injectes < evenements){
+        for(k = 0; k < ENTREES_PAR_ECRITURE && injectes < evenements; k++){
+            memset(&entrees[k], 0, sizeof(entrees[k]));
+            entrees[k].colonne = (nombreEntrees / 2) % NOMBRE_TOUCHES;
+            entrees[k].type = nombreEntrees % 2 ? SETR_EVENEMENT_RELACHEMENT : SETR_EVENEMENT_PRESSION;
+            entrees[k].rafale = evenements - injectes < rafale ? evenements - injectes : rafale;
+            entrees[k].pauseUs = pauseUs;
+            injectes += entrees[k].rafale;
+            nombreEntrees++;
+        }
+        ecrits = write(fdInjection, entrees, k * sizeof(struct setr_injection));
+        if(ecrits != (ssize_t)(k * sizeof(struct setr_injection))){
+            perror("injection");
+            erreur = 1;
+            break;
+        }
+    }
+    injectionNs = maintenantNs() - debutNs;
+
+    atomic_store(&arret, 1);
+    for(i = 0; i < nombreLecteurs; i++)
+        pthread_join(lecteurs[i].thread, NULL);
+    // Les lecteurs s'arrêtent 100 ms après leur dernier événement
+    finNs = maintenantNs() - 100000000LL;
+    close(fdInjection);
+
+    printf("evenements injectes : %ld (rafales de %ld, pause %ld us)\n", injectes, rafale, pauseUs);
+    printf("debit d'injection   : %.0f evenements/s\n", injectes * 1e9 / injectionNs);
+    for(i = 0; i < nombreLecteurs; i++){
+        printf("lecteur %-2d          : %lu recus (%.0f/s), %lu reveils (%.1f evenements/reveil), "
+               "%lu trous, %u sauts, %lu hors d'ordre\n",
+               i, lecteurs[i].recus, lecteurs[i].recus * 1e9 / (finNs - debutNs), lecteurs[i].reveils,
+               lecteurs[i].reveils ? (double)lecteurs[i].recus / lecteurs[i].reveils : 0.0,
+               lecteurs[i].trous, lecteurs[i].sauts, lecteurs[i].desordres);
+        if(lecteurs[i].desordres)
+            erreur = 2;
+        close(lecteurs[i].fd);
+    }
+    return erreur;
+}
@@ -0,0 +1,210 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Fuzzing de setr_commun.c avec libFuzzer
+*
+* Les octets fournis par libFuzzer sont interprétés comme une suite d'opérations
+* sur un état de la matrice, un antirebond et un tampon de diffusion de petite
+* taille (pour atteindre souvent le débordement). Après chaque opération, on
+* vérifie les invariants :
+*
+*   - decoderMatrice : appliquer les changements décodés à l'ancien état redonne
+*     le nouvel état, chaque touche au plus une fois, dans l'ordre des bits;
+*   - filtrerFantomes : une touche est ambiguë si et seulement si elle est un coin
+*     d'un rectangle de touches enfoncées, et seules celles-ci gardent leur état;
+*   - tampon : un lecteur reçoit les événements dans l'ordre, et chaque trou
+*     dans leurs numéros de séquence est exactement compté dans ses sauts;
+*   - antirebond : masqueTransition et l'état stable correspondent aux états
+*     des touches, et une transition n'est confirmée qu'après la durée voulue.
+*
+* Toute violation appelle abort(). Compilé par "make fuzz" (nécessite clang).
+* Pour rejouer un cas sans clang, on peut aussi compiler ce fichier avec
+* -DSETR_FUZZ_AUTONOME : il lit alors chaque fichier donné en argument.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "setr_commun.h"
+
+#define TAILLE_TAMPON 8
+#define DUREE_ANTIREBOND 5
+#define NOMBRE_LECTEURS 2
+
+#define VERIFIER(condition) do { if(!(condition)){ \
+    fprintf(stderr, "Invariant viole (%s:%d) : %s\n", __FILE__, __LINE__, #condition); abort(); } } while(0)
+
+struct lecteurFuzz {
+    u32 position;
+    u32 sauts;
+    u32 prochaineSequence;      // Séquence attendue du prochain événement reçu
+    u32 sautsVerifies;          // Partie de sauts déjà expliquée par des trous
+};
+
+static void verifierDecodage(u64 ancien, u64 nouveau){
+    struct setr_changement changements[NOMBRE_MAX_TOUCHES];
+    unsigned int nombre, i, bit, bitPrecedent = 0;
+    u64 reconstruit = ancien;
+
+    nombre = decoderMatrice(ancien, nouveau, changements);
+    VERIFIER(nombre == (unsigned int)__builtin_popcountll(ancien ^ nouveau));
+    for(i = 0; i < nombre; i++){
+        VERIFIER(changements[i].ligne < NOMBRE_MAX_LIGNES && changements[i].colonne < BITS_PAR_LIGNE);
+        bit = changements[i].ligne * BITS_PAR_LIGNE + changements[i].colonne;
+        VERIFIER(i == 0 || bit > bitPrecedent);
+        VERIFIER(changements[i].etat == ((nouveau >> bit) & 1));
+        reconstruit ^= BIT_ULL(bit);
+        bitPrecedent = bit;
+    }
+    VERIFIER(reconstruit == nouveau);
+}
+
+static void verifierFantomes(u64 stable, u64 brut){
+    // Comparaison avec une recherche exhaustive des rectangles
+    unsigned int ligne, colonne, autreLigne, autreColonne;
+    u64 ambigues, filtre, attendu = 0;
+
+    for(ligne = 0; ligne < NOMBRE_MAX_LIGNES; ligne++)
+        for(colonne = 0; colonne < NOMBRE_MAX_COLONNES; colonne++)
+            for(autreLigne = 0; autreLigne < NOMBRE_MAX_LIGNES; autreLigne++)
+                for(autreColonne = 0; autreColonne < NOMBRE_MAX_COLONNES; autreColonne++)
+                    if(autreLigne != ligne && autreColonne != colonne &&
+                       (brut & BIT_TOUCHE(ligne, colonne)) && (brut & BIT_TOUCHE(ligne, autreColonne)) &&
+                       (brut & BIT_TOUCHE(autreLigne, colonne)) && (brut & BIT_TOUCHE(autreLigne, autreColonne)))
+                        attendu |= BIT_TOUCHE(ligne, colonne);
+
+    filtre = filtrerFantomes(stable, brut, NOMBRE_MAX_LIGNES, &ambigues);
+    VERIFIER(ambigues == attendu);
+    VERIFIER((filtre & ~ambigues) == (brut & ~ambigues));
+    VERIFIER((filtre & ambigues) == (stable & ambigues));
+}
+
+static void lireTampon(const struct setr_entree *tampon, const u32 *tete, struct lecteurFuzz *lecteur,
+                       unsigned int max){
+    struct setr_entree lot[TAILLE_TAMPON];
+    unsigned int premiere, n, i;
+    u32 sequence;
+
+    n = lireLotTampon(tampon, TAILLE_TAMPON, tete, &lecteur->position, &lecteur->sauts, lot, max, &premiere);
+    VERIFIER(n <= max && premiere + n <= max);
+    for(i = premiere; i < premiere + n; i++){
+        // La séquence de chaque événement est sa position d'écriture : tout écart avec celle
+        // attendue doit avoir été compté comme saut, et jamais un événement n'est reçu deux fois
+        sequence = lot[i].evenement.sequence;
+        VERIFIER(sequence - lecteur->prochaineSequence < 0x80000000u);
+        lecteur->sautsVerifies += sequence - lecteur->prochaineSequence;
+        VERIFIER(lecteur->sautsVerifies <= lecteur->sauts);
+        VERIFIER(lot[i].enfilageNs == sequence);
+        lecteur->prochaineSequence = sequence + 1;
+    }
+    lecteur->position += n;
+    VERIFIER(*tete - lecteur->position <= TAILLE_TAMPON - 1);
+}
+
+static void verifierAntirebond(const struct setr_antirebond *antirebond, u64 etatStable){
+    unsigned int bit;
+    u8 etat;
+
+    for(bit = 0; bit < NOMBRE_MAX_TOUCHES; bit++){
+        etat = antirebond->etats[bit];
+        VERIFIER(etat <= TOUCHE_RELACHEMENT);
+        VERIFIER(!!(antirebond->masqueTransition & BIT_ULL(bit)) ==
+                 (etat == TOUCHE_ANTIREBOND || etat == TOUCHE_RELACHEMENT));
+        VERIFIER(!!(etatStable & BIT_ULL(bit)) == (etat == TOUCHE_ENFONCEE || etat == TOUCHE_RELACHEMENT));
+    }
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *donnees, size_t taille){
+    static struct setr_antirebond antirebond;
+    struct setr_entree tampon[TAILLE_TAMPON];
+    struct lecteurFuzz lecteurs[NOMBRE_LECTEURS];
+    struct setr_evenement evenement;
+    u64 matrice = 0, nouvelle, etatStable = 0;
+    u32 tete;
+    s64 horloge = 0, debut, echeance;
+    unsigned int bit, i;
+    int transition;
+    size_t k;
+
+    // Les compteurs libres commencent près du débordement de 32 bits, pour l'exercer aussi
+    memset(&antirebond, 0, sizeof(antirebond));
+    memset(tampon, 0, sizeof(tampon));
+    memset(&evenement, 0, sizeof(evenement));
+    tete = 0xfffffff0u;
+    for(i = 0; i < NOMBRE_LECTEURS; i++){
+        lecteurs[i].position = tete;
+        lecteurs[i].sauts = 0;
+        lecteurs[i].prochaineSequence = tete;
+        lecteurs[i].sautsVerifies = 0;
+    }
+
+    for(k = 0; k + 1 < taille; k += 2){
+        switch(donnees[k] & 3){
+        case 0:
+            // Nouvel état de la matrice : on inverse les touches désignées par l'octet suivant
+            nouvelle = matrice ^ ((u64)donnees[k + 1] << ((donnees[k] >> 2) & 7) * BITS_PAR_LIGNE);
+            verifierDecodage(matrice, nouvelle);
+            verifierFantomes(matrice, nouvelle);
+            matrice = nouvelle;
+            break;
+        case 1:
+            // Le producteur écrit un événement; sa séquence est sa position d'écriture
+            evenement.sequence = tete;
+            ecrireTampon(tampon, TAILLE_TAMPON, &tete, &evenement, tete);
+            break;
+        case 2:
+            // Un lecteur lit un lot de taille 1 à TAILLE_TAMPON
+            lireTampon(tampon, &tete, &lecteurs[(donnees[k] >> 2) & 1], 1 + donnees[k + 1] % TAILLE_TAMPON);
+            break;
+        case 3:
+            // Une lecture brute d'une touche, après une avance d'horloge de 0 à 7
+            bit = donnees[k + 1] & (NOMBRE_MAX_TOUCHES - 1);
+            horloge += (donnees[k] >> 2) & 7;
+            debut = antirebond.debutNs[bit];
+            transition = avancerAntirebond(&antirebond, &etatStable, bit, donnees[k + 1] >> 7,
+                                           horloge, DUREE_ANTIREBOND);
+            VERIFIER(transition >= SETR_REBOND && transition <= 1);
+            if(transition >= 0){
+                VERIFIER(horloge - debut >= DUREE_ANTIREBOND);
+                VERIFIER(transition == (int)((etatStable >> bit) & 1));
+            }
+            verifierAntirebond(&antirebond, etatStable);
+            echeance = prochaineEcheanceAntirebond(&antirebond, DUREE_ANTIREBOND);
+            VERIFIER((echeance == S64_MAX) == (antirebond.masqueTransition == 0));
+            break;
+        }
+    }
+
+    // À la fin, chaque lecteur vide le tampon : tous ses sauts doivent être expliqués
+    for(i = 0; i < NOMBRE_LECTEURS; i++){
+        lireTampon(tampon, &tete, &lecteurs[i], TAILLE_TAMPON);
+        VERIFIER(lecteurs[i].position == tete);
+        VERIFIER(lecteurs[i].sautsVerifies + (tete - lecteurs[i].prochaineSequence) == lecteurs[i].sauts);
+    }
+    return 0;
+}
+
+#ifdef SETR_FUZZ_AUTONOME
+int main(int argc, char *argv[]){
+    // Rejoue chaque fichier donné en argument (par exemple un cas trouvé par libFuzzer)
+    static uint8_t donnees[1 << 16];
+    size_t taille;
+    FILE *fichier;
+    int i;
+
+    for(i = 1; i < argc; i++){
+        fichier = fopen(argv[i], "rb");
+        if(!fichier){
+            perror(argv[i]);
+            return 1;
+        }
+        taille = fread(donnees, 1, sizeof(donnees), fichier);
+        fclose(fichier);
+        LLVMFuzzerTestOneInput(donnees, taille);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,208 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Microbancs d'essai de setr_commun.c en espace utilisateur
+*
+* Ce programme mesure, sans Raspberry Pi, le coût de la logique du pilote
+* indépendante du matériel (voir setr_commun.h) :
+*
+*   - balayerMatrice sur une matrice simulée (4x3, 4x4 et 8x8), en balayages
+*     par seconde; les accès GPIO simulés ne coûtent presque rien, on mesure
+*     donc le balayage lui-même et non le contrôleur GPIO;
+*   - decoderMatrice, filtrerFantomes (par balayage), avancerAntirebond, et une écriture suivie d'une lecture
+*     par lots du tampon de diffusion, en ns par événement.
+*
+* Compilé par "make micro" (voir le Makefile).
+*
+* Usage : micro_banc [iterations]
+*
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "setr_commun.h"
+
+#define TAILLE_TAMPON 1024
+#define LOT_LECTURE 16              // Comme dans setr_driver_core.c
+
+// Matrice simulée : touches enfoncées (un bit par touche, voir BIT_TOUCHE) et lignes actives
+struct matriceSimulee {
+    u64 touches;
+    unsigned long lignes;
+};
+
+static void ecrireLignesSimulees(void *contexte, const unsigned long *motif){
+    ((struct matriceSimulee *)contexte)->lignes = *motif;
+}
+
+static unsigned long lireColonnesSimulees(void *contexte){
+    // Une colonne est active si une touche enfoncée la relie à une ligne active
+    struct matriceSimulee *matrice = contexte;
+    unsigned long colonnes = 0, lignes = matrice->lignes;
+    unsigned int ligne;
+
+    while(lignes){
+        ligne = __ffs64(lignes);
+        lignes &= lignes - 1;
+        colonnes |= (matrice->touches >> (ligne * BITS_PAR_LIGNE)) & 0xff;
+    }
+    return colonnes;
+}
+
+static void attendreSimule(void *contexte, u32 delaiNs){
+    // Le délai d'établissement n'a pas de sens sur une matrice simulée
+}
+
+static s64 maintenantNs(void){
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (s64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static u64 aleatoire(u64 *etat){
+    // xorshift64 : assez bon pour générer des états de matrice, et déterministe
+    *etat ^= *etat << 13;
+    *etat ^= *etat >> 7;
+    *etat ^= *etat << 17;
+    return *etat;
+}
+
+static void mesurerBalayage(unsigned int nombreLignes, unsigned int nombreColonnes, long iterations){
+    struct matriceSimulee matrice = {0, 0};
+    struct setr_gpio gpio = {ecrireLignesSimulees, lireColonnesSimulees, attendreSimule, &matrice};
+    unsigned long motifsLignes[NOMBRE_MAX_LIGNES];
+    u32 delaisNs[NOMBRE_MAX_LIGNES] = {0};
+    unsigned long masqueColonnes = (1UL << nombreColonnes) - 1;
+    volatile u64 resultat = 0;
+    unsigned int ligne;
+    s64 debut, duree;
+    long i;
+
+    for(ligne = 0; ligne < NOMBRE_MAX_LIGNES; ligne++)
+        motifsLignes[ligne] = 1UL << ligne;
+    matrice.touches = BIT_TOUCHE(0, 0) | BIT_TOUCHE(nombreLignes - 1, nombreColonnes - 1);
+
+    debut = maintenantNs();
+    for(i = 0; i < iterations; i++)
+        resultat ^= balayerMatrice(&gpio, nombreLignes, masqueColonnes, motifsLignes, delaisNs);
+    duree = maintenantNs() - debut;
+
+    printf("balayerMatrice %ux%u        : %12.0f balayages/s (%.1f ns/balayage)\n", nombreLignes, nombreColonnes,
+           iterations * 1e9 / duree, (double)duree / iterations);
+}
+
+static void mesurerDecodage(long iterations){
+    struct setr_changement changements[NOMBRE_MAX_TOUCHES];
+    u64 etat = 88172645463325252ULL, ancien = 0, nouveau;
+    unsigned long evenements = 0;
+    s64 debut, duree;
+    long i;
+
+    debut = maintenantNs();
+    for(i = 0; i < iterations; i++){
+        // Au plus quelques touches changent d'un balayage à l'autre, comme sur un vrai clavier
+        nouveau = ancien ^ (aleatoire(&etat) & aleatoire(&etat) & aleatoire(&etat));
+        evenements += decoderMatrice(ancien, nouveau, changements);
+        ancien = nouveau;
+    }
+    duree = maintenantNs() - debut;
+
+    printf("decoderMatrice            : %12.1f ns/evenement (%lu evenements)\n",
+           (double)duree / (evenements ? evenements : 1), evenements);
+}
+
+static void mesurerFantomes(long iterations){
+    // Matrices 8x8 de une à quatre touches au hasard : la plupart sont lisibles, certaines
+    // forment un rectangle
+    u64 etat = 1181783497276652981ULL, brut, ambigues, stable = 0;
+    unsigned long bloquees = 0;
+    s64 debut, duree;
+    long i;
+
+    debut = maintenantNs();
+    for(i = 0; i < iterations; i++){
+        brut = BIT_ULL(aleatoire(&etat) & 63) | BIT_ULL(aleatoire(&etat) & 63) | BIT_ULL(aleatoire(&etat) & 63);
+        if(i & 1)
+            brut |= BIT_ULL(aleatoire(&etat) & 63);
+        stable = filtrerFantomes(stable, brut, NOMBRE_MAX_LIGNES, &ambigues);
+        bloquees += ambigues != 0;
+    }
+    duree = maintenantNs() - debut;
+
+    printf("filtrerFantomes 8x8       : %12.1f ns/balayage (%lu balayages bloques)\n",
+           (double)duree / iterations, bloquees);
+}
+
+static void mesurerAntirebond(long iterations){
+    static struct setr_antirebond antirebond;
+    u64 etat = 2463534242ULL, etatStable = 0;
+    unsigned long evenements = 0;
+    s64 debut, duree, horloge = 0;
+    unsigned int bit;
+    long i;
+
+    debut = maintenantNs();
+    for(i = 0; i < iterations; i++){
+        // Une touche au hasard, lue enfoncée ou relâchée, 1 ms simulée entre deux lectures
+        // (antirebond de 5 ms) : on obtient un mélange de rebonds et de transitions confirmées
+        bit = aleatoire(&etat) & (NOMBRE_MAX_TOUCHES - 1);
+        horloge += 1000000;
+        if(avancerAntirebond(&antirebond, &etatStable, bit, aleatoire(&etat) & 3, horloge, 5000000) >= 0)
+            evenements++;
+    }
+    duree = maintenantNs() - debut;
+
+    printf("avancerAntirebond         : %12.1f ns/lecture (%lu transitions confirmees)\n",
+           (double)duree / iterations, evenements);
+}
+
+static void mesurerTampon(long iterations){
+    static struct setr_entree tampon[TAILLE_TAMPON];
+    struct setr_entree lot[LOT_LECTURE];
+    struct setr_evenement evenement;
+    u32 tete = 0, position = 0, sauts = 0;
+    unsigned int premiere, n;
+    unsigned long lus = 0;
+    s64 debut, duree;
+    long i;
+
+    memset(&evenement, 0, sizeof(evenement));
+    debut = maintenantNs();
+    for(i = 0; i < iterations; i++){
+        // Le lecteur vide le tampon tous les LOT_LECTURE événements, comme un read() de 16 octets
+        evenement.sequence = i;
+        ecrireTampon(tampon, TAILLE_TAMPON, &tete, &evenement, i);
+        if((i & (LOT_LECTURE - 1)) == LOT_LECTURE - 1){
+            n = lireLotTampon(tampon, TAILLE_TAMPON, &tete, &position, &sauts, lot, LOT_LECTURE, &premiere);
+            lus += n;
+            position += n;
+        }
+    }
+    duree = maintenantNs() - debut;
+
+    printf("ecrireTampon+lireLotTampon: %12.1f ns/evenement (%lu lus, %u sauts)\n",
+           (double)duree / iterations, lus, sauts);
+}
+
+int main(int argc, char *argv[]){
+    long iterations = argc > 1 ? atol(argv[1]) : 10000000;
+
+    if(iterations <= 0){
+        fprintf(stderr, "Usage : %s [iterations]\n", argv[0]);
+        return 1;
+    }
+
+    mesurerBalayage(4, 3, iterations);
+    mesurerBalayage(4, 4, iterations);
+    mesurerBalayage(8, 8, iterations);
+    mesurerDecodage(iterations);
+    mesurerFantomes(iterations);
+    mesurerAntirebond(iterations);
+    mesurerTampon(iterations);
+    return 0;
+}
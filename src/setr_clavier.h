@@ -0,0 +1,128 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Définitions partagées entre les pilotes du clavier et les applications
+*
+* Ce fichier peut être inclus tel quel depuis l'espace utilisateur. Il décrit
+* le journal d'événements que /dev/setrclavierN rend accessible par mmap :
+*
+*   - la première page contient l'en-tête (struct setr_entete_journal);
+*   - les événements (struct setr_evenement) commencent à l'octet
+*     entete->decalage et forment un buffer circulaire de entete->capacite
+*     entrées (une puissance de 2).
+*
+* Le pilote est l'unique producteur : il écrit un événement, puis publie
+* entete->tete. L'application est l'unique consommateur : elle lit les
+* événements de entete->queue à entete->tete (exclu), puis publie entete->queue.
+* tete et queue sont des compteurs libres de 32 bits, l'entrée correspondante
+* est (index & (capacite - 1)). Lorsque le journal est vide, l'application peut
+* s'endormir avec poll()/select() sur le même descripteur de fichier.
+*
+* read() retourne quant à lui les caractères des touches pressées (mode texte,
+* par défaut) ou, après SETR_IOCTL_MODE_LECTURE, des tableaux de struct
+* setr_evenement (mode binaire, pressions et relâchements). SETR_IOCTL_VIDER
+* retourne aussi des struct setr_evenement, jusqu'à N par appel. Chaque
+* descripteur de fichier a sa propre position : plusieurs processus peuvent
+* lire /dev/setrclavierN en même temps et reçoivent tous chaque événement.
+* Un lecteur trop lent perd ses plus anciens événements plutôt que de
+* ralentir le pilote; SETR_IOCTL_SAUTS permet de savoir combien.
+* SETR_IOCTL_INSTANTANE donne les touches enfoncées à l'instant présent.
+*
+*/
+
+#ifndef SETR_CLAVIER_H
+#define SETR_CLAVIER_H
+
+#include <linux/types.h>
+#include <linux/ioctl.h>
+
+// Types d'événements
+#define SETR_EVENEMENT_RELACHEMENT  0
+#define SETR_EVENEMENT_PRESSION     1
+#define SETR_EVENEMENT_REPETITION   2   // Touche toujours enfoncée (répétition automatique)
+#define SETR_EVENEMENT_BLOCAGE      3   // Accord bloqué : des touches fantômes possibles sont
+                                        // retenues jusqu'à ce que la matrice redevienne lisible
+                                        // (ligne et colonne : la première de ces touches)
+
+// Un événement du clavier, de taille fixe (24 octets)
+struct setr_evenement {
+    __u64 horodatageNs;     // ktime_get() (CLOCK_MONOTONIC) au début du balayage, en ns
+    __u32 sequence;         // Numéro de séquence; un trou indique des événements perdus
+    __u16 code;             // Code KEY_* de la touche (voir linux/input-event-codes.h)
+    __u8  ligne;            // Ligne de la touche dans la matrice
+    __u8  colonne;          // Colonne de la touche dans la matrice
+    __u8  type;             // SETR_EVENEMENT_*
+    __u8  caractere;        // Caractère ASCII associé à la touche
+    __u8  reserve[6];
+};
+
+// En-tête du journal, au début de la zone projetée par mmap
+struct setr_entete_journal {
+    __u32 tete;             // Prochain index écrit par le pilote (lecture seule pour l'application)
+    __u32 queue;            // Prochain index à lire (écrit par l'application)
+    __u32 capacite;         // Nombre d'entrées du journal (puissance de 2)
+    __u32 tailleEvenement;  // sizeof(struct setr_evenement)
+    __u32 decalage;         // Position du premier événement, en octets, depuis le début de la zone
+    __u32 perdus;           // Événements ignorés parce que le journal était plein
+};
+
+// Argument de SETR_IOCTL_VIDER
+struct setr_vidage {
+    __u64 evenements;       // Adresse d'un tableau de struct setr_evenement
+    __u32 capacite;         // Nombre d'entrées de ce tableau (au moins 1)
+    __u32 minimum;          // Attendre qu'au moins ce nombre d'événements soit disponible (0 : ne pas attendre)
+    __s32 delaiMs;          // Attente maximale, en ms (négatif : sans limite, 0 : ne pas attendre)
+    __u32 nombre;           // Rempli par le pilote : nombre d'événements copiés
+};
+
+// Argument de SETR_IOCTL_INSTANTANE : état courant de la matrice, sans consommer d'événement
+struct setr_instantane {
+    __u64 touches;          // Touches enfoncées après antirebond, bit ligne * 8 + colonne
+    __u64 horodatageNs;     // Début du balayage ayant produit cet état (CLOCK_MONOTONIC), en ns
+    __u32 sequence;         // Numéro de séquence du prochain événement : touches tient compte
+                            // de tous les événements de numéro inférieur
+    __u32 balayages;        // Nombre de balayages ayant mis l'instantané à jour (compteur libre)
+};
+
+// Événement synthétique, écrit dans /sys/kernel/debug/setrclavierN/injecter (root seulement)
+// lorsque le module est chargé avec activerInjection=1. Il suit le même chemin qu'une touche
+// détectée par le balayage (tampon de diffusion et journal), sans GPIO ni sous-système input :
+// sert à mesurer le débit maximal de read() et du journal. Un write() contient une ou plusieurs
+// entrées, traitées dans l'ordre; il retourne le nombre d'octets des entrées traitées.
+struct setr_injection {
+    __u8  ligne;            // Touche de la disposition du clavier (caractère et code)
+    __u8  colonne;
+    __u8  type;             // SETR_EVENEMENT_RELACHEMENT, _PRESSION ou _REPETITION
+    __u8  reserve;
+    __u32 rafale;           // Nombre de fois que l'événement est ajouté, sans pause (0 : une fois)
+    __u32 pauseUs;          // Attente après la rafale, avant l'entrée suivante
+};
+
+// Modes de lecture de read() (argument de SETR_IOCTL_MODE_LECTURE)
+#define SETR_LECTURE_TEXTE      0   // Un caractère par touche pressée
+#define SETR_LECTURE_BINAIRE    1   // Des struct setr_evenement complètes
+
+// Commandes ioctl de /dev/setrclavierN
+#define SETR_IOCTL_MAGIC    'S'
+
+// Retourne le nombre d'événements que ce descripteur de fichier a perdus (écrasés avant
+// d'avoir été lus) depuis le dernier appel, puis remet ce compteur à zéro
+#define SETR_IOCTL_SAUTS    _IOR(SETR_IOCTL_MAGIC, 1, __u32)
+
+// Choisit le mode de lecture de read() pour ce descripteur de fichier; l'argument est
+// passé par valeur (SETR_LECTURE_*). En mode binaire, read() retourne un nombre entier
+// d'événements et échoue (EINVAL) si la taille demandée n'en contient aucun.
+#define SETR_IOCTL_MODE_LECTURE _IO(SETR_IOCTL_MAGIC, 2)
+
+// Attend qu'au moins minimum événements soient disponibles, ou que delaiMs expire, puis
+// copie jusqu'à capacite événements en un seul appel, quel que soit le mode de lecture.
+// Avec O_NONBLOCK, on n'attend jamais. nombre peut être inférieur à minimum (délai expiré).
+#define SETR_IOCTL_VIDER    _IOWR(SETR_IOCTL_MAGIC, 3, struct setr_vidage)
+
+// Copie l'état courant de la matrice (touches enfoncées) sans rien retirer de la file de ce
+// descripteur. En modes irq et hybrid, la matrice n'est balayée que lorsqu'une touche est
+// enfoncée : horodatageNs peut alors être ancien, mais touches reste exact. Aussi lisible
+// dans /sys/class/setr/setrclavierN/etat.
+#define SETR_IOCTL_INSTANTANE _IOR(SETR_IOCTL_MAGIC, 4, struct setr_instantane)
+
+#endif
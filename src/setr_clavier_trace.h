@@ -0,0 +1,114 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Points de traçage (tracepoints) des pilotes du clavier
+*
+* Ces événements suivent une touche de bout en bout : interruption, début du
+* balayage, touche détectée, ajout au buffer et lecture par l'application.
+* Ils sont visibles dans /sys/kernel/tracing/events/setr_clavier/ et peuvent
+* être activés avec, par exemple :
+*
+*   echo 1 > /sys/kernel/tracing/events/setr_clavier/enable
+*   cat /sys/kernel/tracing/trace_pipe
+*
+* Un seul fichier source du module doit définir CREATE_TRACE_POINTS avant
+* d'inclure ce fichier.
+*
+*/
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM setr_clavier
+
+#if !defined(_SETR_CLAVIER_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define _SETR_CLAVIER_TRACE_H
+
+#include <linux/tracepoint.h>
+
+// Entrée dans le gestionnaire d'interruption (pilote par interruptions seulement)
+TRACE_EVENT(setr_irq,
+    TP_PROTO(int irq),
+    TP_ARGS(irq),
+    TP_STRUCT__entry(
+        __field(int, irq)
+    ),
+    TP_fast_assign(
+        __entry->irq = irq;
+    ),
+    TP_printk("irq=%d", __entry->irq)
+);
+
+// Début d'un balayage de la matrice
+TRACE_EVENT(setr_balayage,
+    TP_PROTO(u64 etatPrecedent),
+    TP_ARGS(etatPrecedent),
+    TP_STRUCT__entry(
+        __field(u64, etatPrecedent)
+    ),
+    TP_fast_assign(
+        __entry->etatPrecedent = etatPrecedent;
+    ),
+    TP_printk("etat_precedent=0x%llx", __entry->etatPrecedent)
+);
+
+// Pression ou relâchement détecté par le balayage
+TRACE_EVENT(setr_touche,
+    TP_PROTO(int ligne, int colonne, int etat, u16 code),
+    TP_ARGS(ligne, colonne, etat, code),
+    TP_STRUCT__entry(
+        __field(int, ligne)
+        __field(int, colonne)
+        __field(int, etat)
+        __field(u16, code)
+    ),
+    TP_fast_assign(
+        __entry->ligne = ligne;
+        __entry->colonne = colonne;
+        __entry->etat = etat;
+        __entry->code = code;
+    ),
+    TP_printk("ligne=%d colonne=%d %s code=%u", __entry->ligne, __entry->colonne,
+              __print_symbolic(__entry->etat, { 0, "relachement" }, { 1, "pression" }, { 2, "repetition" },
+                               { 3, "blocage" }),
+              __entry->code)
+);
+
+// Caractère ajouté au buffer lu par read(), avec le délai depuis le début du balayage
+TRACE_EVENT(setr_enfilage,
+    TP_PROTO(char caractere, s64 latenceNs),
+    TP_ARGS(caractere, latenceNs),
+    TP_STRUCT__entry(
+        __field(char, caractere)
+        __field(s64, latenceNs)
+    ),
+    TP_fast_assign(
+        __entry->caractere = caractere;
+        __entry->latenceNs = latenceNs;
+    ),
+    TP_printk("caractere=%c latence_balayage_ns=%lld", __entry->caractere, __entry->latenceNs)
+);
+
+// Unités copiées par un read() (caractères, ou événements en mode binaire), avec le délai
+// d'attente de la plus ancienne. Émis une seule fois par lecture.
+TRACE_EVENT(setr_lecture,
+    TP_PROTO(size_t nombre, s64 latenceNs),
+    TP_ARGS(nombre, latenceNs),
+    TP_STRUCT__entry(
+        __field(size_t, nombre)
+        __field(s64, latenceNs)
+    ),
+    TP_fast_assign(
+        __entry->nombre = nombre;
+        __entry->latenceNs = latenceNs;
+    ),
+    TP_printk("nombre=%zu latence_enfilage_ns=%lld", __entry->nombre, __entry->latenceNs)
+);
+
+#endif
+
+// Ce fichier n'est pas dans include/trace/events : on indique à define_trace.h où le trouver
+// (le Makefile ajoute le répertoire du module au chemin d'inclusion)
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE setr_clavier_trace
+#include <trace/define_trace.h>
@@ -0,0 +1,191 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Logique du pilote indépendante du matériel et du noyau
+*
+* Voir setr_commun.h. Ce fichier ne doit utiliser que ce que setr_commun.h
+* définit aussi hors du noyau : il est compilé tel quel en espace utilisateur
+* par les cibles "micro" et "fuzz" du Makefile.
+*
+*/
+
+#include "setr_commun.h"
+
+
+u64 balayerMatrice(const struct setr_gpio *gpio, unsigned int nombreLignes, unsigned long masqueColonnes,
+                   const unsigned long *motifsLignes, const u32 *delaisNs){
+    // Chaque ligne ne coûte que deux transactions GPIO : l'écriture de toutes les lignes
+    // (un patron précalculé) et la lecture de toutes les colonnes. Le résultat de la ligne
+    // est placé dans l'état de la matrice sans aucun branchement.
+    u64 matrice = 0;
+    unsigned int ligne;
+    u32 delai;
+
+    for(ligne = 0; ligne < nombreLignes; ligne++){
+        gpio->ecrireLignes(gpio->contexte, &motifsLignes[ligne]);
+        delai = READ_ONCE(delaisNs[ligne]);
+        if(delai)
+            gpio->attendre(gpio->contexte, delai);
+        matrice |= (u64)(gpio->lireColonnes(gpio->contexte) & masqueColonnes) << (ligne * BITS_PAR_LIGNE);
+    }
+    return matrice;
+}
+
+unsigned int decoderMatrice(u64 ancien, u64 nouveau, struct setr_changement *changements){
+    // Un seul XOR donne les touches ayant changé, et on ne parcourt que ses bits à 1
+    u64 differences = ancien ^ nouveau;
+    unsigned int bit, nombre = 0;
+
+    while(differences){
+        bit = __ffs64(differences);
+        differences &= differences - 1;
+        changements[nombre].ligne = bit / BITS_PAR_LIGNE;
+        changements[nombre].colonne = bit % BITS_PAR_LIGNE;
+        changements[nombre].etat = (nouveau >> bit) & 1;
+        nombre++;
+    }
+    return nombre;
+}
+
+u64 filtrerFantomes(u64 stable, u64 brut, unsigned int nombreLignes, u64 *ambigues){
+    // Deux lignes ayant au moins deux colonnes enfoncées en commun forment un rectangle dont
+    // les quatre coins paraissent enfoncés : ces colonnes sont ambiguës dans les deux lignes.
+    // Toute autre combinaison (en particulier trois touches n'étant pas en « L ») se lit
+    // sans ambiguïté. Une ligne ayant moins de deux touches ne peut former de rectangle.
+    u64 masque = 0;
+    unsigned int ligne, autre;
+    u8 touchesLigne, communes;
+
+    for(ligne = 0; ligne + 1 < nombreLignes; ligne++){
+        touchesLigne = brut >> (ligne * BITS_PAR_LIGNE);
+        if(!(touchesLigne & (touchesLigne - 1)))
+            continue;
+        for(autre = ligne + 1; autre < nombreLignes; autre++){
+            communes = touchesLigne & (u8)(brut >> (autre * BITS_PAR_LIGNE));
+            if(communes & (communes - 1))
+                masque |= ((u64)communes << (ligne * BITS_PAR_LIGNE)) | ((u64)communes << (autre * BITS_PAR_LIGNE));
+        }
+    }
+    *ambigues = masque;
+    return (brut & ~masque) | (stable & masque);
+}
+
+int avancerAntirebond(struct setr_antirebond *ar, u64 *etatStable, unsigned int bit, bool brut,
+                      s64 maintenantNs, s64 dureeNs){
+    // Une pression n'est acceptée que si la touche est restée enfoncée pendant dureeNs;
+    // un retour à l'état précédent pendant cette période est considéré comme un rebond.
+    // La transition est horodatée au premier contact, et non à la fin de l'antirebond.
+    // *etatStable et masqueTransition sont tenus à jour en même temps que l'état de la touche.
+    u64 bitTouche = BIT_ULL(bit);
+    bool echue = maintenantNs - ar->debutNs[bit] >= dureeNs;
+
+    switch(ar->etats[bit]){
+    case TOUCHE_REPOS:
+        if(brut){
+            ar->etats[bit] = TOUCHE_ANTIREBOND;
+            ar->debutNs[bit] = maintenantNs;
+            ar->masqueTransition |= bitTouche;
+        }
+        break;
+    case TOUCHE_ANTIREBOND:
+        if(!brut){
+            ar->etats[bit] = TOUCHE_REPOS;
+            ar->masqueTransition &= ~bitTouche;
+            return SETR_REBOND;
+        }
+        else if(echue){
+            ar->etats[bit] = TOUCHE_ENFONCEE;
+            ar->masqueTransition &= ~bitTouche;
+            *etatStable |= bitTouche;
+            return 1;
+        }
+        break;
+    case TOUCHE_ENFONCEE:
+        if(!brut){
+            ar->etats[bit] = TOUCHE_RELACHEMENT;
+            ar->debutNs[bit] = maintenantNs;
+            ar->masqueTransition |= bitTouche;
+        }
+        break;
+    case TOUCHE_RELACHEMENT:
+        if(brut){
+            ar->etats[bit] = TOUCHE_ENFONCEE;
+            ar->masqueTransition &= ~bitTouche;
+            return SETR_REBOND;
+        }
+        else if(echue){
+            ar->etats[bit] = TOUCHE_REPOS;
+            ar->masqueTransition &= ~bitTouche;
+            *etatStable &= ~bitTouche;
+            return 0;
+        }
+        break;
+    }
+    return SETR_AUCUNE_TRANSITION;
+}
+
+s64 prochaineEcheanceAntirebond(const struct setr_antirebond *ar, s64 dureeNs){
+    u64 candidats = ar->masqueTransition;
+    s64 echeance, prochaine = S64_MAX;
+    unsigned int bit;
+
+    while(candidats){
+        bit = __ffs64(candidats);
+        candidats &= candidats - 1;
+        echeance = ar->debutNs[bit] + dureeNs;
+        if(echeance < prochaine)
+            prochaine = echeance;
+    }
+    return prochaine;
+}
+
+void ecrireTampon(struct setr_entree *tampon, u32 taille, u32 *tete,
+                  const struct setr_evenement *evenement, u64 enfilageNs){
+    // Le producteur n'attend jamais les lecteurs : c'est à eux de détecter qu'ils ont été
+    // dépassés (voir lireLotTampon). La décision d'écraser ou non une entrée pas encore lue
+    // (politique de débordement) revient à l'appelant.
+    struct setr_entree *entree = &tampon[*tete & (taille - 1)];
+
+    // La tête précédente doit être visible avant qu'on commence à écraser une entrée :
+    // un lecteur qui relit la tête après sa copie sait ainsi quelles entrées ont pu changer.
+    smp_wmb();
+    entree->evenement = *evenement;
+    entree->enfilageNs = enfilageNs;
+    // L'entrée doit être entièrement écrite avant que la nouvelle tête ne soit visible
+    smp_store_release(tete, *tete + 1);
+}
+
+u32 sauterEcrases(u32 taille, u32 tete, u32 *position){
+    // On ne conserve que taille - 1 entrées : l'entrée restante est celle que le producteur
+    // est peut-être en train d'écrire.
+    u32 ecrases = 0;
+
+    if(tete - *position > taille - 1){
+        ecrases = tete - *position - (taille - 1);
+        *position += ecrases;
+    }
+    return ecrases;
+}
+
+unsigned int lireLotTampon(const struct setr_entree *tampon, u32 taille, const u32 *tete,
+                           u32 *position, u32 *sauts, struct setr_entree *lot, unsigned int max,
+                           unsigned int *premiere){
+    // Les entrées sont d'abord copiées dans lot; on relit ensuite la tête pour écarter celles
+    // qui ont pu être écrasées pendant la copie. Celles-ci sont forcément au début du lot.
+    u32 teteLue, debut;
+    unsigned int n, i, ecrases;
+
+    teteLue = smp_load_acquire(tete);
+    *sauts += sauterEcrases(taille, teteLue, position);
+    n = teteLue - *position < max ? teteLue - *position : max;
+    for(i = 0; i < n; i++)
+        lot[i] = tampon[(*position + i) & (taille - 1)];
+
+    smp_rmb();
+    teteLue = READ_ONCE(*tete);
+    debut = *position;
+    *sauts += sauterEcrases(taille, teteLue, position);
+    ecrases = *position - debut < n ? *position - debut : n;
+    *premiere = ecrases;
+    return n - ecrases;
+}
@@ -0,0 +1,148 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Logique du pilote indépendante du matériel et du noyau
+*
+* setr_commun.c regroupe ce qui ne dépend ni des GPIO ni des API du noyau :
+*   - le balayage de la matrice, à travers une interface GPIO abstraite
+*     (struct setr_gpio);
+*   - le décodage de l'état de la matrice en pressions et relâchements, et la
+*     détection des touches fantômes;
+*   - la machine d'antirebond par touche du mode irq;
+*   - l'écriture et la lecture par lots du tampon de diffusion.
+*
+* Ce fichier est compilé dans le module (setr_driver.ko), mais aussi en espace
+* utilisateur par les cibles "micro" et "fuzz" du Makefile (voir banc/), pour
+* mesurer ses performances et le tester sans Raspberry Pi. Hors du noyau, les
+* quelques primitives du noyau utilisées sont redéfinies plus bas.
+*
+*/
+
+#ifndef SETR_COMMUN_H
+#define SETR_COMMUN_H
+
+#ifdef __KERNEL__
+#include <linux/types.h>
+#include <linux/bitops.h>
+#include <linux/compiler.h>
+#include <linux/limits.h>
+#include <asm/barrier.h>
+#else
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+// Accès partagés entre le producteur et les lecteurs du tampon de diffusion
+#define READ_ONCE(x) (*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, v) (*(volatile __typeof__(x) *)&(x) = (v))
+#define smp_load_acquire(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define smp_store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#define smp_wmb() __atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb() __atomic_thread_fence(__ATOMIC_ACQUIRE)
+
+#define S64_MAX INT64_MAX
+#define BIT_ULL(n) (1ULL << (n))
+#define __ffs64(x) ((unsigned int)__builtin_ctzll(x))
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#endif
+
+#include "setr_clavier.h"           // struct setr_evenement
+
+// L'état de la matrice est conservé dans un seul mot de 64 bits : la touche (ligne, colonne)
+// correspond au bit ligne * BITS_PAR_LIGNE + colonne. On supporte donc jusqu'à 8x8 touches.
+#define NOMBRE_MAX_LIGNES 8
+#define NOMBRE_MAX_COLONNES 8
+#define BITS_PAR_LIGNE 8
+#define BIT_TOUCHE(ligne, colonne) (1ULL << ((ligne) * BITS_PAR_LIGNE + (colonne)))
+#define NOMBRE_MAX_TOUCHES (NOMBRE_MAX_LIGNES * BITS_PAR_LIGNE)
+
+// Interface GPIO utilisée par le balayage. Dans le module, elle pilote les GPIO du clavier
+// (voir setr_driver_core.c); en espace utilisateur, une matrice simulée (voir banc/).
+struct setr_gpio {
+    void (*ecrireLignes)(void *contexte, const unsigned long *motif);  // Bit i : ligne i active
+    unsigned long (*lireColonnes)(void *contexte);                      // Bit j : colonne j active
+    void (*attendre)(void *contexte, u32 delaiNs);                      // Délai d'établissement
+    void *contexte;
+};
+
+// Balaye toutes les lignes et retourne l'état brut de la matrice (un bit par touche)
+u64 balayerMatrice(const struct setr_gpio *gpio, unsigned int nombreLignes, unsigned long masqueColonnes,
+                   const unsigned long *motifsLignes, const u32 *delaisNs);
+
+// Un changement d'état de touche, décodé à partir de deux états de la matrice
+struct setr_changement {
+    u8 ligne;
+    u8 colonne;
+    u8 etat;                        // 1 : pression, 0 : relâchement
+};
+
+// Remplit changements (NOMBRE_MAX_TOUCHES entrées au plus) avec les touches dont l'état diffère
+// entre ancien et nouveau, dans l'ordre des bits, et retourne leur nombre
+unsigned int decoderMatrice(u64 ancien, u64 nouveau, struct setr_changement *changements);
+
+// Le clavier n'a pas de diodes : lorsque trois touches formant trois coins d'un rectangle sont
+// enfoncées, le courant passe aussi par le quatrième coin, qui paraît enfoncé. On ne peut alors
+// plus savoir lesquelles des quatre touches le sont vraiment. Retourne brut, où ces touches
+// ambiguës (placées dans *ambigues) gardent l'état qu'elles ont dans stable.
+u64 filtrerFantomes(u64 stable, u64 brut, unsigned int nombreLignes, u64 *ambigues);
+
+// États de la machine d'antirebond de chaque touche (mode irq)
+enum etatTouche {
+    TOUCHE_REPOS,           // Relâchée et stable
+    TOUCHE_ANTIREBOND,      // Vue enfoncée, en attente de confirmation
+    TOUCHE_ENFONCEE,        // Enfoncée et stable (pression signalée)
+    TOUCHE_RELACHEMENT      // Vue relâchée, en attente de confirmation
+};
+
+// Antirebond de toutes les touches d'un clavier, indexé par numéro de bit
+struct setr_antirebond {
+    u8 etats[NOMBRE_MAX_TOUCHES];           // enum etatTouche
+    s64 debutNs[NOMBRE_MAX_TOUCHES];        // Premier contact vu dans l'état courant
+    u64 masqueTransition;                   // Touches en antirebond ou en relâchement
+};
+
+#define SETR_AUCUNE_TRANSITION (-1)
+#define SETR_REBOND (-2)
+
+// Fait avancer l'antirebond de la touche bit selon sa valeur lue (brut). Retourne 1 (pression)
+// ou 0 (relâchement) si une transition est confirmée, horodatée à ar->debutNs[bit], et met
+// alors à jour *etatStable; SETR_REBOND si la lecture annule une transition en cours;
+// sinon, SETR_AUCUNE_TRANSITION.
+int avancerAntirebond(struct setr_antirebond *ar, u64 *etatStable, unsigned int bit, bool brut,
+                      s64 maintenantNs, s64 dureeNs);
+
+// Échéance (en ns) la plus proche parmi les touches en transition; S64_MAX s'il n'y en a pas
+s64 prochaineEcheanceAntirebond(const struct setr_antirebond *ar, s64 dureeNs);
+
+// Une entrée du tampon de diffusion. Le tampon a un seul producteur (le balayage) et des
+// lecteurs ayant chacun leur position; tete et les positions sont des compteurs libres,
+// et taille est une puissance de 2.
+struct setr_entree {
+    struct setr_evenement evenement;
+    u64 enfilageNs;                        // Instant d'ajout, pour l'histogramme enfilage -> lecture
+};
+
+// Producteur : écrit une entrée à la position *tete, puis publie la nouvelle tête
+void ecrireTampon(struct setr_entree *tampon, u32 taille, u32 *tete,
+                  const struct setr_evenement *evenement, u64 enfilageNs);
+
+// Lecteur : avance *position au-delà des entrées que le producteur a pu écraser, et
+// retourne leur nombre. On ne conserve que taille - 1 entrées (voir setr_commun.c).
+u32 sauterEcrases(u32 taille, u32 tete, u32 *position);
+
+// Lecteur : copie dans lot au plus max entrées à partir de *position, sans avancer
+// *position au-delà de celles-ci. Les entrées écrasées pendant la copie sont écartées
+// (*position et *sauts en tiennent compte); les entrées valides commencent à lot[*premiere].
+// Retourne leur nombre.
+unsigned int lireLotTampon(const struct setr_entree *tampon, u32 taille, const u32 *tete,
+                           u32 *position, u32 *sauts, struct setr_entree *lot, unsigned int max,
+                           unsigned int *premiere);
+
+#endif
@@ -0,0 +1,252 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Déclarations partagées entre le cœur du pilote et ses modes de balayage
+*
+* Le module setr_driver est formé de quatre fichiers :
+*   - setr_driver_core.c    : pilote de plateforme, fichiers /dev/setrclavierN,
+*                             buffer, journal, GPIO;
+*   - setr_driver_polling.c : balayage périodique par un thread noyau;
+*   - setr_driver_irq.c     : balayage déclenché par les interruptions des colonnes;
+*   - setr_commun.c         : logique indépendante du noyau (balayage, décodage,
+*                             antirebond, tampon), aussi compilée en espace utilisateur.
+*
+* Chaque clavier lié au pilote a son propre contexte (struct setrClavier); seuls
+* les paramètres du module et le thread de polling sont communs à tous.
+*
+* Contrairement à setr_clavier.h, ce fichier n'est utilisé que dans le noyau.
+*
+*/
+
+#ifndef SETR_DRIVER_H
+#define SETR_DRIVER_H
+
+#include <linux/types.h>
+#include <linux/ktime.h>
+#include <linux/gpio/consumer.h>
+#include <linux/cdev.h>
+#include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+#include <linux/hrtimer.h>
+#include <linux/atomic.h>
+#include <linux/rcupdate.h>
+#include <linux/seqlock.h>
+
+#include "setr_clavier.h"
+#include "setr_commun.h"
+
+// Le nom de notre périphérique et le nom de sa classe. Le clavier 0 est accessible par
+// /dev/setrclavier, comme auparavant, et le clavier d'index N >= 1 par /dev/setrclavierN.
+#define DEV_NAME "setrclavier"
+#define CLS_NAME "setr"
+
+// Nombre maximal de claviers (et donc de numéros mineurs) gérés par le module
+#define NOMBRE_MAX_CLAVIERS 8
+
+// Les dimensions de chaque clavier, jusqu'à NOMBRE_MAX_LIGNES x NOMBRE_MAX_COLONNES
+// (voir setr_commun.h), sont celles de ses groupes de GPIO (paramètres gpiosLignes et
+// gpiosColonnes, ou device tree) et sont connues au moment où il est lié au pilote.
+
+// Modes de balayage (paramètre "mode" du module)
+enum modeBalayage {
+    MODE_POLLING,       // Thread noyau seulement
+    MODE_IRQ,           // Interruptions et antirebond par touche seulement
+    MODE_HYBRIDE        // Interruptions au repos, thread noyau tant qu'une touche est enfoncée
+};
+extern enum modeBalayage modeBalayage;
+
+// Politiques de débordement du tampon, lorsque le lecteur le plus en retard n'a plus de place
+enum politiqueDebordement {
+    POLITIQUE_IGNORER_NOUVEAU,             // Le nouvel événement est ignoré
+    POLITIQUE_ECRASER_ANCIEN,              // Le plus ancien événement est écrasé
+    POLITIQUE_SUSPENDRE                    // Le balayage est suspendu jusqu'à ce qu'il y ait de la place
+};
+
+// Histogrammes de latence, exposés dans debugfs (/sys/kernel/debug/setrclavierN/).
+// La classe i compte les latences comprises dans [2^i, 2^(i+1)[ ns; la dernière classe
+// regroupe toutes les latences plus grandes. Les compteurs sont atomiques : plusieurs
+// lecteurs peuvent ajouter une latence en même temps (voir ajouterLatence).
+#define NOMBRE_CLASSES_HISTO 32
+struct histogramme {
+    atomic_long_t classes[NOMBRE_CLASSES_HISTO];
+    atomic_long_t total;
+    atomic64_t sommeNs;
+    atomic64_t maxNs;
+};
+
+// Compteurs d'activité de chaque clavier, un exemplaire par processeur : chaque chemin les
+// incrémente sans verrou (this_cpu_inc), et l'attribut sysfs correspondant
+// (/sys/class/setr/setrclavierN/compteurs/) fait la somme à la lecture.
+struct compteursClavier {
+    unsigned long balayages;                // Balayages de la matrice, tous modes confondus
+    unsigned long irq;                      // Interruptions des colonnes reçues
+    unsigned long irqParasites;             // Balayages lancés par une interruption, sans changement
+    unsigned long rebonds;                  // Transitions annulées par l'antirebond (mode irq)
+    unsigned long enfiles;                  // Événements ajoutés au tampon de diffusion
+    unsigned long lus;                      // Événements (ou caractères) copiés vers les lecteurs
+    unsigned long lecturesVides;            // Appels à read() n'ayant rien retourné (0 ou -EAGAIN)
+    unsigned long tempetes;                 // Colonnes masquées pour une tempête d'interruptions
+};
+
+// Valeur "etat" d'ajouterEvenement, la même que celle des événements EV_KEY du sous-système
+// input : 0 pour un relâchement, 1 pour une pression et 2 pour une répétition automatique.
+// Un accord bloqué (voir eliminerFantomes) n'est pas transmis au sous-système input.
+#define ETAT_REPETITION 2
+#define ETAT_BLOCAGE 3
+
+// Classes de touches. Chaque classe a sa propre répétition automatique (délai et période),
+// modifiable dans sysfs (attributs repetition_chiffres et repetition_fonctions).
+enum classeTouche {
+    CLASSE_CHIFFRE,         // '0' à '9'
+    CLASSE_FONCTION,        // Toutes les autres touches
+    NOMBRE_CLASSES_TOUCHES
+};
+
+// Mesures du temps d'établissement d'une ligne, faites par la dernière calibration
+// (voir calibrerEtablissement). Exposées dans debugfs (/sys/kernel/debug/setrclavierN/etablissement).
+struct mesureEtablissement {
+    unsigned int essais;                    // Nombre de mesures tentées
+    unsigned int observations;              // Mesures où une touche a fait changer les colonnes
+    u64 minNs, maxNs, sommeNs;
+};
+
+// Disposition des touches d'un clavier : caractère, code KEY_* et classe de chaque touche, indexés
+// par son numéro de bit dans l'état de la matrice (ligne * BITS_PAR_LIGNE + colonne).
+// Elle est remplacée en entier lorsqu'on la modifie (attribut sysfs "touches") : le balayage
+// la lit sans verrou, sous rcu_read_lock.
+struct dispositionClavier {
+    struct rcu_head rcu;
+    char caracteres[NOMBRE_MAX_TOUCHES];
+    unsigned short codes[NOMBRE_MAX_TOUCHES];
+    unsigned char classes[NOMBRE_MAX_TOUCHES]; // enum classeTouche
+};
+
+// Contexte d'un clavier. Alloué au moment où le pilote de plateforme est lié au
+// périphérique (setrclavier_probe), et libéré lorsqu'il en est détaché.
+struct setrClavier {
+    struct device *parent;                  // Périphérique de plateforme
+    struct device *setrDevice;              // /dev/setrclavierN et ses attributs sysfs
+    struct cdev cdev;
+    int index;                              // N de /dev/setrclavierN (numéro mineur)
+    char phys[32];                          // Chemin du périphérique input
+
+    struct gpio_descs *gpioLecture, *gpioEcriture;
+    struct setr_gpio gpio;                  // Interface utilisée par balayerMatrice
+    u64 dernierEtat;                        // Dernier état de la matrice, vu par le mode qui la balaye
+    u64 masqueAmbigu;                       // Touches fantômes possibles, retenues (voir eliminerFantomes)
+    struct setr_instantane instantane;      // Copie de dernierEtat lisible sans verrou (voir publierInstantane)
+    seqcount_t compteurInstantane;
+
+    // Géométrie, fixée par le nombre de GPIO de chaque groupe, et tables précalculées
+    unsigned int nombreLignes, nombreColonnes;
+    unsigned long motifRepos;               // Toutes les lignes actives, pour attendre une interruption
+    unsigned long masqueColonnes;           // Bits valides d'une lecture des colonnes
+    struct dispositionClavier __rcu *disposition;
+
+    // Délai entre l'activation de chaque ligne et la lecture des colonnes, fixé par le paramètre
+    // delaiEtablissementUs, par la calibration ou dans sysfs (attribut etablissement_ns)
+    u32 delaisEtablissementNs[NOMBRE_MAX_LIGNES];
+    struct mesureEtablissement mesuresEtablissement[NOMBRE_MAX_LIGNES];
+    int resultatCalibration;
+
+    // Répétition automatique de la dernière touche enfoncée (voir emettreRepetition)
+    unsigned int delaiRepetitionMs[NOMBRE_CLASSES_TOUCHES];   // 0 : pas de répétition
+    unsigned int periodeRepetitionMs[NOMBRE_CLASSES_TOUCHES];
+    int toucheRepetee;                      // Bit de la touche répétée, -1 si aucune
+    ktime_t prochaineRepetition;            // KTIME_MAX si aucune répétition n'est prévue
+
+    // Tampon de diffusion lu par read(), et fichiers ouverts (setr_driver_core.c)
+    struct setr_entree *tampon;             // tailleBuffer entrées
+    u32 teteTampon;                         // Nombre d'événements ajoutés depuis la liaison (compteur libre)
+    struct list_head lecteurs;              // Fichiers ouverts, pour trouver le plus en retard
+    spinlock_t verrouLecteurs;
+    wait_queue_head_t fileAttente;          // Lecteurs endormis en attente d'un événement
+    struct fasync_struct *fileAsync;        // Processus à notifier par SIGIO
+    enum politiqueDebordement politique;
+    unsigned long perdus, niveauMax, suspensions, blocages; // Compteurs exposés dans sysfs
+    struct compteursClavier __percpu *compteurs;
+    u32 queueConnue;                        // Position d'un lecteur au moins aussi en retard que le plus lent
+    u32 positionLue;                        // Position la plus avancée atteinte par un read(), où commence
+                                            // un nouveau lecteur (voir dev_open)
+    bool lecteurActif;                      // Au moins un fichier ouvert a déjà lu (voir calculerQueue)
+    bool nouveauLecteur;                    // Un fichier vient de lire pour la première fois
+
+    // Journal d'événements projeté dans l'espace utilisateur (voir setr_clavier.h)
+    struct setr_entete_journal *journal;
+    struct setr_evenement *evenements;      // Première entrée du journal, à journal + PAGE_SIZE
+    u32 teteJournal;                        // Copie privée de journal->tete
+    u32 sequenceCourante;                   // Numéro de séquence du prochain événement
+
+    struct input_dev *clavierInput;         // NULL si activerInput est désactivé
+
+    // Le balayage est suspendu tant que le clavier n'a pas d'utilisateur (voir ajouterUtilisateur)
+    struct mutex verrouUtilisateurs;        // Protège les trois champs suivants
+    unsigned int utilisateurs;              // Fichiers ouverts et ouvertures du périphérique input
+    bool balayagePret;                      // Interruptions enregistrées, le balayage peut commencer
+    bool balayageActif;                     // Lu sans verrou par le balayage (READ_ONCE)
+
+    // Statistiques de latence
+    struct histogramme histoIrqBalayage, histoBalayageEnfilage, histoEnfilageLecture;
+    struct histogramme histoGigue;          // Retard des balayages du thread de polling sur leur échéance
+    struct dentry *repertoireDebug;
+    ktime_t debutBalayage;                  // Début du balayage en cours
+    ktime_t instantIrq;                     // Interruption ayant lancé le prochain balayage (0 : aucune)
+
+    // Balayage par le thread de polling (setr_driver_polling.c)
+    struct list_head lienPolling;           // Dans la liste des claviers du thread
+    ktime_t echeance, derniereActivite;
+    u64 periodeNs;
+    unsigned int balayagesLibres;
+    bool enAttenteIrq;                      // Mode hybride : le thread attend une interruption de ce clavier
+    bool reveilDemande;                     // Mode hybride : une interruption a demandé un balayage
+
+    // Balayage par interruptions (setr_driver_irq.c)
+    struct mutex verrouBalayage;            // Sérialise les balayages (un thread d'IRQ par colonne)
+    atomic_t irqEnCours;                    // 1 lorsque les IRQ des colonnes sont masquées
+    struct hrtimer minuterieAntirebond;     // Relance le balayage à la fin d'une période d'antirebond
+    struct hrtimer minuterieRepetition;     // Relance le balayage à l'échéance de la prochaine répétition
+    struct setr_antirebond antirebond;      // État de l'antirebond de chaque touche
+    unsigned int irqId[NOMBRE_MAX_COLONNES]; // Numéro d'interruption de chaque broche de lecture
+
+    // Protection contre les tempêtes d'interruptions (voir detecterTempete et gererRepli)
+    unsigned int irqFenetre[NOMBRE_MAX_COLONNES]; // Interruptions de chaque colonne dans sa fenêtre
+    ktime_t debutFenetreIrq[NOMBRE_MAX_COLONNES];
+    unsigned long colonnesTempete;          // Colonnes masquées jusqu'à la fin du repli
+    ktime_t finRepli;                       // Fin du balayage périodique de repli
+    ktime_t debutRepli;                     // 0 : pas en repli
+    u64 repliNs;                            // Temps total passé en repli, exposé dans sysfs
+};
+
+// Définis dans setr_driver_core.c
+u64 lireMatrice(struct setrClavier *clavier);
+unsigned long lireColonnes(struct setrClavier *clavier); // Bit j : colonne j active
+void poserMotifRepos(struct setrClavier *clavier);
+ktime_t noterDebutBalayage(struct setrClavier *clavier);
+void ajouterLatence(struct histogramme *histo, s64 latenceNs);
+void ajouterEvenement(struct setrClavier *clavier, int ligne, int colonne, int etat, ktime_t horodatage, bool premier);
+bool emettreRepetition(struct setrClavier *clavier, ktime_t maintenant, bool premier);
+bool eliminerFantomes(struct setrClavier *clavier, u64 *matrice, ktime_t horodatage, bool premier);
+void publierEvenements(struct setrClavier *clavier);
+void publierInstantane(struct setrClavier *clavier, ktime_t horodatage); // À la fin de chaque balayage
+bool tamponSature(struct setrClavier *clavier); // Politique backpressure : le balayage doit être reporté
+
+// Définis dans setr_driver_polling.c. Un seul thread balaye tous les claviers.
+int demarrerPolling(void);
+void arreterPolling(void);
+void ajouterPolling(struct setrClavier *clavier);
+void retirerPolling(struct setrClavier *clavier);
+void reveillerPolling(struct setrClavier *clavier); // Mode hybride : appelable en contexte d'interruption
+void verrouillerPolling(void);                      // Empêche le thread de balayer quelque clavier que ce soit
+void deverrouillerPolling(void);
+
+// Définis dans setr_driver_irq.c
+int demarrerIrq(struct setrClavier *clavier);  // Les IRQ restent masquées jusqu'à reprendreIrq
+void arreterIrq(struct setrClavier *clavier);
+void suspendreIrq(struct setrClavier *clavier);
+void reprendreIrq(struct setrClavier *clavier);
+void activerIrqColonnes(struct setrClavier *clavier);
+void relancerBalayage(struct setrClavier *clavier);
+
+#endif
@@ -0,0 +1,2190 @@
+/******************************************************************************
+* H2025
+* LABORATOIRE 4, Systèmes embarqués et temps réel
+* Cœur du pilote du clavier, commun à tous les modes de balayage
+* Marc-André Gardner, H2025
+*
+* Ce fichier contient tout ce qui ne dépend pas de la manière de balayer la
+* matrice : le pilote de plateforme, les fichiers /dev/setrclavierN, le buffer
+* circulaire, le journal partagé par mmap, le périphérique input, les GPIO et
+* les statistiques.
+*
+* Le module peut gérer plusieurs claviers à la fois : chaque périphérique de
+* plateforme "setrclavier" (ou nœud "setr,clavier" du device tree) reçoit son
+* propre contexte (struct setrClavier) et son propre fichier /dev/setrclavierN.
+* Par défaut, le module crée lui-même le clavier 0, relié aux GPIO des paramètres
+* gpiosLignes et gpiosColonnes. La géométrie de chaque clavier (jusqu'à 8x8) est
+* celle de ses groupes de GPIO, et la disposition de ses touches est modifiable.
+* Le balayage lui-même est fait par l'un des modes suivants, choisi au
+* chargement avec le paramètre "mode" :
+*
+*   - polling : un thread noyau balaye la matrice périodiquement (par défaut)
+*               (setr_driver_polling.c);
+*   - irq     : les interruptions des colonnes lancent un balayage, suivi d'un
+*               antirebond par touche (setr_driver_irq.c);
+*   - hybrid  : au repos, on attend une interruption des colonnes, toutes les
+*               lignes à 1. Dès qu'une touche est enfoncée, le thread de polling
+*               prend le relais à période fixe, tant que la matrice n'est pas
+*               redevenue libre, puis on retourne à l'attente d'une interruption.
+*
+* Prenez le temps de lire attentivement les notes de cours et les commentaires
+* contenus dans ce fichier, ils contiennent des informations cruciales.
+*
+*/
+
+// Inclusion des en-têtes nécessaires
+// Vous pouvez en ajouter, mais n'oubliez pas que vous n'avez PAS
+// accès la libc! Vous ne pouvez vous servir que des fonctions fournies
+// par le noyau Linux.
+#include <linux/init.h>             // Macros spécifiques des fonctions d'un module
+#include <linux/module.h>           // En-tête général des modules noyau
+#include <linux/device.h>           // Pour créer un pilote
+#include <linux/kernel.h>           // Différentes définitions de types liés au noyau
+#include <linux/gpio.h>             // Pour accéder aux GPIO du Raspberry Pi
+#include <linux/gpio/machine.h>     // Idem
+#include <linux/fs.h>               // Pour accéder au système de fichier et créer un fichier spécial dans /dev
+#include <linux/uaccess.h>          // Permet d'accéder à copy_to_user et copy_from_user
+#include <linux/delay.h>            // Fonctions d'attente, en particulier msleep
+#include <linux/string.h>           // Différentes fonctions de manipulation de string, plus memset et memcpy
+#include <linux/mutex.h>            // Mutex et synchronisation
+#include <linux/interrupt.h>        // Définit les symboles pour les interruptions et les tasklets
+#include <linux/atomic.h>           // Synchronisation par valeur atomique
+#include <linux/wait.h>             // Files d'attente pour les lectures bloquantes
+#include <linux/poll.h>             // Support de poll/select/epoll
+#include <linux/slab.h>             // Allocation de l'état de chaque fichier ouvert
+#include <linux/list.h>             // Liste des fichiers ouverts
+#include <linux/spinlock.h>         // Protection de la liste des fichiers ouverts
+#include <linux/log2.h>             // is_power_of_2
+#include <linux/input.h>            // Sous-système input (evdev)
+#include <linux/ktime.h>            // Horodatage des événements
+#include <linux/vmalloc.h>          // Allocation du journal partagé avec l'espace utilisateur
+#include <linux/mm.h>               // Support de mmap
+#include <linux/debugfs.h>          // Histogrammes de latence dans debugfs
+#include <linux/seq_file.h>         // Affichage des histogrammes
+#include <linux/platform_device.h>  // Pilote de plateforme (un périphérique par clavier)
+#include <linux/of.h>               // Liaison par le device tree
+#include <linux/mod_devicetable.h>  // Table de correspondance du device tree
+#include <linux/cdev.h>             // Un fichier /dev/setrclavierN par clavier
+#include <linux/idr.h>              // Attribution des numéros de clavier
+#include <linux/rcupdate.h>         // Remplacement de la disposition des touches pendant le balayage
+#include <linux/ctype.h>            // Validation de la disposition des touches
+#include <linux/percpu.h>           // Compteurs d'activité par processeur
+
+#include "setr_clavier.h"           // Format du journal d'événements partagé
+#include "setr_driver.h"            // Déclarations partagées entre le cœur et les modes de balayage
+
+// Définit (une seule fois par module) les points de traçage déclarés dans setr_clavier_trace.h
+#define CREATE_TRACE_POINTS
+#include "setr_clavier_trace.h"
+
+
+// Déclaration des fonctions pour gérer notre fichier
+// En plus de open(), close() et read(), nous supportons poll() (et donc select/epoll),
+// fasync (notification par SIGIO), mmap et ioctl (voir setr_clavier.h)
+static int      dev_open(struct inode *, struct file *);
+static int      dev_release(struct inode *, struct file *);
+static ssize_t  dev_read(struct file *, char *, size_t, loff_t *);
+static __poll_t dev_poll(struct file *, poll_table *);
+static int      dev_fasync(int, struct file *, int);
+static int      dev_mmap(struct file *, struct vm_area_struct *);
+static long     dev_ioctl(struct file *, unsigned int, unsigned long);
+
+static struct file_operations fops =
+{
+   .owner = THIS_MODULE,
+   .open = dev_open,
+   .read = dev_read,
+   .poll = dev_poll,
+   .fasync = dev_fasync,
+   .mmap = dev_mmap,
+   .unlocked_ioctl = dev_ioctl,
+   .compat_ioctl = compat_ptr_ioctl,
+   .release = dev_release,
+};
+
+// Variables globales et statiques utilisées dans le driver. L'état propre à chaque clavier
+// se trouve dans struct setrClavier (voir setr_driver.h).
+static dev_t  premierNumero;               // Premier numéro (majeur, mineur) réservé pour nos claviers
+static DEFINE_IDA(idaClaviers);            // Index N des claviers liés (/dev/setrclavierN)
+
+// Tampon de diffusion lu par read(). Le balayage y écrit chaque événement (pression,
+// relâchement ou répétition) une seule fois, et chaque fichier ouvert y conserve sa propre position
+// (struct lecteurClavier) : l'ajout coûte donc la même chose quel que soit le nombre de lecteurs.
+// En mode texte, read() ne retourne que le caractère des pressions et des répétitions; en mode binaire, il
+// retourne les événements complets (voir SETR_IOCTL_MODE_LECTURE). Les entrées (struct setr_entree)
+// sont écrites et lues par setr_commun.c.
+
+// État propre à chaque fichier ouvert (filep->private_data)
+struct lecteurClavier {
+    struct setrClavier *clavier;           // Clavier correspondant au fichier ouvert
+    struct list_head lien;                 // Dans clavier->lecteurs
+    struct mutex verrou;                   // Sérialise les lectures faites sur ce fichier
+    u32 position;                          // Prochain événement à lire (même compteur que teteTampon)
+    u32 sauts;                             // Événements écrasés avant d'avoir été lus (voir SETR_IOCTL_SAUTS)
+    bool binaire;                          // read() retourne des struct setr_evenement (voir SETR_IOCTL_MODE_LECTURE)
+    bool projete;                          // Le journal a été projeté par mmap (voir dev_poll)
+    bool actif;                            // A déjà lu (read ou SETR_IOCTL_VIDER) : compte dans calculerQueue
+};
+
+// Nombre d'événements lus à la fois dans le tampon avant leur copie vers l'application
+// (le lot est conservé sur la pile noyau, il doit donc rester petit)
+#define LOT_LECTURE 16
+
+// Nombre maximal d'événements injectés à la fois, pendant lesquels le balayage est bloqué
+#define LOT_INJECTION 64
+
+// Noms des politiques de débordement (paramètre politiqueDebordement et attribut sysfs "politique")
+static const char * const nomsPolitiques[] = {
+    [POLITIQUE_IGNORER_NOUVEAU] = "drop-newest",
+    [POLITIQUE_ECRASER_ANCIEN] = "drop-oldest",
+    [POLITIQUE_SUSPENDRE] = "backpressure",
+};
+static enum politiqueDebordement politiqueInitiale; // Politique de chaque nouveau clavier
+
+static struct class*  setrClasse  = NULL;  // Contiendra les informations sur la classe de notre pilote
+static struct platform_device *peripheriqueDefaut = NULL; // Clavier 0, créé par le module (voir creerPeripherique)
+
+
+// Les GPIO du clavier 0 : un GPIO d'écriture par ligne (gpiosLignes) et un GPIO de lecture par
+// colonne (gpiosColonnes). Leur nombre fixe la géométrie du clavier, jusqu'à 8x8 : par exemple,
+// gpiosColonnes=12,16,20,21 pour un clavier à 4 colonnes. Nous vous proposons les choix suivants,
+// mais ce n'est pas obligatoire. Chaque valeur est le numéro du _GPIO_ (PAS le Pin# du Raspberry
+// Pi). Par exemple, la _pin_ 36 du Raspberry Pi Zero correspond au GPIO 16, c'est donc 16 qu'il
+// faut mettre ici. Voyez le schéma au début de l'énoncé pour plus de détails.
+static int gpiosLignes[NOMBRE_MAX_LIGNES] = {5, 6, 13, 19};
+static int nombreGpiosLignes = 4;
+module_param_array(gpiosLignes, int, &nombreGpiosLignes, S_IRUGO);
+MODULE_PARM_DESC(gpiosLignes, " GPIO d'ecriture du clavier 0, un par ligne (5,6,13,19 par defaut)");
+
+static int gpiosColonnes[NOMBRE_MAX_COLONNES] = {12, 16, 20};
+static int nombreGpiosColonnes = 3;
+module_param_array(gpiosColonnes, int, &nombreGpiosColonnes, S_IRUGO);
+MODULE_PARM_DESC(gpiosColonnes, " GPIO de lecture du clavier 0, un par colonne (12,16,20 par defaut)");
+
+// Table de correspondances du clavier 0, construite au chargement à partir des paramètres
+// précédents (voir creerTableGpios)
+static struct gpiod_lookup_table *gpios_table = NULL;
+
+// Patrons d'écriture précalculés, appliqués en un seul appel gpiod_set_array_value_cansleep.
+// Le bit i de chaque patron correspond au GPIO d'index i du groupe "ecriture".
+// Ils sont les mêmes pour tous les claviers : seul le nombre de lignes balayées change.
+static unsigned long motifsLignes[NOMBRE_MAX_LIGNES];  // Une seule ligne active
+
+// Disposition par défaut (paramètre touches vide) : celle des claviers 3x4 et 4x4 du
+// laboratoire. Un clavier à 3 colonnes n'en utilise que les 3 premières.
+static const char dispositionDefaut[4][4] = {
+    {'1', '2', '3', 'A'},
+    {'4', '5', '6', 'B'},
+    {'7', '8', '9', 'C'},
+    {'*', '0', '#', 'D'}
+};
+
+// Sérialise les modifications de disposition (voir changerDisposition)
+static DEFINE_MUTEX(verrouDispositions);
+
+// Mode de balayage choisi au chargement (voir l'en-tête de ce fichier)
+static char *mode = "polling";
+module_param(mode, charp, S_IRUGO);
+MODULE_PARM_DESC(mode, " Mode de balayage : polling, irq ou hybrid (polling par defaut)");
+
+static const char * const nomsModes[] = {
+    [MODE_POLLING] = "polling",
+    [MODE_IRQ] = "irq",
+    [MODE_HYBRIDE] = "hybrid",
+};
+enum modeBalayage modeBalayage;
+
+// Si ce paramètre est à 0, une lecture sans caractère disponible retourne immédiatement 0,
+// comme dans la version originale du pilote (utile pour tail -f ---disable-inotify)
+static bool lectureBloquante = true;
+module_param(lectureBloquante, bool, S_IRUGO);
+MODULE_PARM_DESC(lectureBloquante, " Bloquer read() jusqu'a l'arrivee d'un caractere (1 par defaut)");
+
+
+// Le nombre d'événements conservés dans le tampon de diffusion. Un lecteur en retard de plus
+// de tailleBuffer - 1 événements perd les plus anciens (voir dev_read).
+// Doit être une puissance de 2 (les modulos sont remplacés par un masque).
+// Utilisez une petite valeur (par exemple 16) pour tester le comportement en cas de dépassement.
+static unsigned int tailleBuffer = 1024;
+module_param(tailleBuffer, uint, S_IRUGO);
+MODULE_PARM_DESC(tailleBuffer, " Capacite du tampon de diffusion, puissance de 2 (1024 par defaut)");
+
+// Politique initiale lorsque le tampon est plein (modifiable ensuite dans sysfs) :
+// drop-newest, drop-oldest ou backpressure
+static char *politiqueDebordement = "drop-oldest";
+module_param(politiqueDebordement, charp, S_IRUGO);
+MODULE_PARM_DESC(politiqueDebordement, " Politique de debordement : drop-newest, drop-oldest ou backpressure (drop-oldest par defaut)");
+
+// Si ce paramètre est activé, le clavier est aussi exposé par le sous-système input
+// (/dev/input/eventX), avec des événements de pression et de relâchement horodatés
+// au moment du balayage.
+static bool activerInput = false;
+module_param(activerInput, bool, S_IRUGO);
+MODULE_PARM_DESC(activerInput, " Exposer aussi le clavier via le sous-systeme input/evdev (0 par defaut)");
+
+// Par défaut, un clavier est balayé en permanence : les touches pressées pendant que personne
+// n'a ouvert /dev/setrclavierN restent dans le tampon et sont reçues par le prochain lecteur
+// (voir dev_open). Si ce paramètre est désactivé, le balayage est plutôt suspendu sans
+// utilisateur (aucun fichier /dev/setrclavierN ouvert, ni /dev/input/eventX) : le thread de
+// polling ne balaye plus le clavier, ses interruptions sont masquées, et seules les touches
+// pressées pendant qu'un fichier est ouvert sont vues.
+static bool balayerSansLecteur = true;
+module_param(balayerSansLecteur, bool, S_IRUGO);
+MODULE_PARM_DESC(balayerSansLecteur, " Balayer le clavier meme lorsqu'il n'est pas ouvert (1 par defaut, 0 pour suspendre le balayage)");
+
+// Nombre d'événements que peut contenir le journal partagé par mmap (puissance de 2)
+static unsigned int tailleJournal = 1024;
+module_param(tailleJournal, uint, S_IRUGO);
+MODULE_PARM_DESC(tailleJournal, " Nombre d'evenements du journal accessible par mmap, puissance de 2 (1024 par defaut)");
+
+// Si ce paramètre est activé, chaque clavier a aussi un fichier debugfs "injecter", qui ajoute
+// des événements synthétiques (struct setr_injection) au tampon et au journal, pour mesurer
+// le débit de lecture sans appuyer sur les touches
+static bool activerInjection = false;
+module_param(activerInjection, bool, S_IRUGO);
+MODULE_PARM_DESC(activerInjection, " Creer le fichier debugfs injecter, qui ajoute des evenements synthetiques (0 par defaut)");
+
+// Si ce paramètre est activé, le module crée lui-même le clavier 0, relié aux GPIO de
+// gpiosLignes et gpiosColonnes. Désactivez-le lorsque les claviers sont décrits par le device tree.
+static bool creerPeripherique = true;
+module_param(creerPeripherique, bool, S_IRUGO);
+MODULE_PARM_DESC(creerPeripherique, " Creer le clavier 0 a partir de gpiosLignes et gpiosColonnes (1 par defaut)");
+
+// Disposition des touches de chaque nouveau clavier, ligne par ligne, les lignes étant séparées
+// par des virgules (par exemple "123,456,789,*0#"). Si elle est vide, on utilise celle des
+// claviers du laboratoire (dispositionDefaut), ce qui n'est possible que jusqu'à 4x4.
+// Elle peut ensuite être modifiée pour chaque clavier dans sysfs (attribut "touches").
+static char *touches = "";
+module_param(touches, charp, S_IRUGO);
+MODULE_PARM_DESC(touches, " Disposition des touches, lignes separees par des virgules (celle du laboratoire par defaut)");
+
+// Répétition automatique initiale de chaque nouveau clavier, pour toutes les classes de touches :
+// une touche tenue enfoncée pendant delaiRepetitionMs est répétée toutes les periodeRepetitionMs.
+// 0 désactive la répétition. Modifiable ensuite pour chaque classe dans sysfs
+// (attributs repetition_chiffres et repetition_fonctions).
+static unsigned int delaiRepetitionMs = 0;
+module_param(delaiRepetitionMs, uint, S_IRUGO);
+MODULE_PARM_DESC(delaiRepetitionMs, " Delai avant la premiere repetition d'une touche tenue (en ms, 0 pour aucune repetition, 0 par defaut)");
+
+static unsigned int periodeRepetitionMs = 100;
+module_param(periodeRepetitionMs, uint, S_IRUGO);
+MODULE_PARM_DESC(periodeRepetitionMs, " Periode de repetition d'une touche tenue (en ms, 100ms par defaut)");
+
+// Contrôleur GPIO auquel sont reliés les GPIO du clavier 0
+static char *puceGpio = "pinctrl-bcm2835";
+module_param(puceGpio, charp, S_IRUGO);
+MODULE_PARM_DESC(puceGpio, " Etiquette du controleur GPIO du clavier (pinctrl-bcm2835 par defaut)");
+
+// Délai initial entre l'activation d'une ligne et la lecture des colonnes. Inutile avec le
+// clavier du laboratoire, mais nécessaire lorsque la matrice est simulée par un programme (banc/).
+// La calibration (voir calibrerEtablissement) le remplace par un délai mesuré pour chaque ligne.
+static unsigned int delaiEtablissementUs = 0;
+module_param(delaiEtablissementUs, uint, S_IRUGO);
+MODULE_PARM_DESC(delaiEtablissementUs, " Delai entre l'activation d'une ligne et la lecture des colonnes (en us, 0 par defaut)");
+
+// Si ce paramètre est activé, chaque clavier est calibré dès qu'il est lié au pilote. Une
+// calibration ne mesure que les lignes dont une touche est enfoncée : au chargement, sans
+// touche enfoncée, les délais restent ceux de delaiEtablissementUs.
+static bool calibrerAuChargement = false;
+module_param(calibrerAuChargement, bool, S_IRUGO);
+MODULE_PARM_DESC(calibrerAuChargement, " Calibrer le delai d'etablissement de chaque ligne au chargement (0 par defaut)");
+
+// Marge ajoutée au temps d'établissement mesuré le plus long, en pourcentage
+static unsigned int margeEtablissement = 50;
+module_param(margeEtablissement, uint, S_IRUGO);
+MODULE_PARM_DESC(margeEtablissement, " Marge de securite ajoutee au delai d'etablissement mesure (en %, 50 par defaut)");
+
+// Paramètres de la calibration : nombre de mesures par ligne, attente assurant que les colonnes
+// sont stables (référence), et nombre de lectures identiques consécutives exigées
+#define ESSAIS_ETABLISSEMENT 8
+#define ATTENTE_REFERENCE_US 1000
+#define LECTURES_STABLES 4
+
+// Sérialise les demandes de calibration faites par sysfs
+static DEFINE_MUTEX(verrouCalibration);
+
+
+static void preparerMotifs(void){
+    // Précalcule les patrons de balayage, pour que la boucle de balayage n'ait plus
+    // qu'à passer des bitmaps déjà prêts à l'API GPIO.
+    int ligne;
+
+    for(ligne = 0; ligne < NOMBRE_MAX_LIGNES; ligne++)
+        motifsLignes[ligne] = BIT(ligne);
+}
+
+static int creerTableGpios(void){
+    // Construit et enregistre la table de correspondances du clavier 0 ("setrclavier.0").
+    // Chaque entrée réfère à _un_ GPIO en particulier :
+    // - Le contrôleur est puceGpio ("pinctrl-bcm2835", le contrôleur du Raspberry Pi Zero W,
+    //      par défaut), ce qui permet d'utiliser une puce gpio-sim pour les essais (voir banc/).
+    // - L'identifiant "ecriture" ou "lecture" nous permet d'obtenir nos GPIO en groupe
+    //      avec gpiod_get_array.
+    // - L'index désigne spécifiquement chaque GPIO dans un groupe. Lorsque vous lirez ou
+    //      écrirez dans un groupe, le "bitmap" demandé est un entier où chaque _bit_ correspond
+    //      à l'état d'un GPIO. Par exemple, avec les valeurs par défaut, le bit le moins
+    //      significatif (LSB) du bitmap appliqué sur le groupe "écriture" écrira/lira le GPIO 5.
+    //      Le second bit sera lié au GPIO 6, le 3e au GPIO 13, et ainsi de suite.
+    // - GPIO_ACTIVE_HIGH signifie qu'écrire un "1" entraîne un voltage "haut" sur la pin. Vous
+    //      pouvez trouver les autres drapeaux possibles ici :
+    //      https://www.kernel.org/doc/html/v5.2/driver-api/gpio/board.html#platform-data
+    // Les autres claviers peuvent être décrits par leur propre table (avec un autre dev_id)
+    // ou par un nœud du device tree ayant les propriétés "ecriture-gpios" et "lecture-gpios".
+    int i;
+
+    if(nombreGpiosLignes == 0 || nombreGpiosColonnes == 0)
+        return -EINVAL;
+
+    // La dernière entrée reste vide (kzalloc) : elle marque la fin de la table
+    gpios_table = kzalloc(struct_size(gpios_table, table, nombreGpiosLignes + nombreGpiosColonnes + 1), GFP_KERNEL);
+    if(!gpios_table)
+        return -ENOMEM;
+    gpios_table->dev_id = DEV_NAME ".0";
+    for(i = 0; i < nombreGpiosLignes; i++)
+        gpios_table->table[i] = GPIO_LOOKUP_IDX(puceGpio, gpiosLignes[i], "ecriture", i, GPIO_ACTIVE_HIGH);
+    for(i = 0; i < nombreGpiosColonnes; i++)
+        gpios_table->table[nombreGpiosLignes + i] = GPIO_LOOKUP_IDX(puceGpio, gpiosColonnes[i], "lecture", i, GPIO_ACTIVE_HIGH);
+    gpiod_add_lookup_table(gpios_table);
+    return 0;
+}
+
+static unsigned short codeTouche(char caractere){
+    // Code KEY_* transmis au sous-système input pour une touche. Les chiffres, '*', '#' et
+    // 'A' à 'D' reçoivent leur code de pavé numérique (KEY_NUMERIC_*), les autres lettres
+    // celui de la lettre correspondante, et tout autre caractère KEY_UNKNOWN.
+    static const unsigned short codesLettres[26] = {
+        KEY_A, KEY_B, KEY_C, KEY_D, KEY_E, KEY_F, KEY_G, KEY_H, KEY_I, KEY_J, KEY_K, KEY_L, KEY_M,
+        KEY_N, KEY_O, KEY_P, KEY_Q, KEY_R, KEY_S, KEY_T, KEY_U, KEY_V, KEY_W, KEY_X, KEY_Y, KEY_Z
+    };
+
+    if(caractere >= '0' && caractere <= '9')
+        return KEY_NUMERIC_0 + (caractere - '0');
+    if(caractere >= 'A' && caractere <= 'D')
+        return KEY_NUMERIC_A + (caractere - 'A');
+    if(caractere == '*')
+        return KEY_NUMERIC_STAR;
+    if(caractere == '#')
+        return KEY_NUMERIC_POUND;
+    if(isalpha(caractere))
+        return codesLettres[tolower(caractere) - 'a'];
+    return KEY_UNKNOWN;
+}
+
+static void remplirTouche(struct dispositionClavier *disposition, unsigned int bit, char caractere){
+    disposition->caracteres[bit] = caractere;
+    disposition->codes[bit] = codeTouche(caractere);
+    disposition->classes[bit] = isdigit(caractere) ? CLASSE_CHIFFRE : CLASSE_FONCTION;
+}
+
+static int lireDisposition(struct setrClavier *clavier, const char *texte, struct dispositionClavier *disposition){
+    // Remplit disposition à partir de texte (même format que le paramètre touches) : exactement
+    // nombreLignes rangées de nombreColonnes caractères imprimables, séparées par des virgules.
+    // Un texte vide (ou un simple saut de ligne, écrit par echo dans sysfs) donne la
+    // disposition par défaut.
+    unsigned int ligne = 0, colonne = 0;
+    const char *c;
+
+    if(texte[0] == '\0' || texte[0] == '\n'){
+        if(clavier->nombreLignes > 4 || clavier->nombreColonnes > 4)
+            return -EINVAL;
+        for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+            for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+                remplirTouche(disposition, ligne * BITS_PAR_LIGNE + colonne, dispositionDefaut[ligne][colonne]);
+        return 0;
+    }
+
+    for(c = texte; *c && *c != '\n'; c++){
+        if(*c == ','){
+            if(colonne != clavier->nombreColonnes)
+                return -EINVAL;
+            ligne++;
+            colonne = 0;
+            continue;
+        }
+        if(!isgraph(*c) || ligne >= clavier->nombreLignes || colonne >= clavier->nombreColonnes)
+            return -EINVAL;
+        remplirTouche(disposition, ligne * BITS_PAR_LIGNE + colonne, *c);
+        colonne++;
+    }
+    if(ligne != clavier->nombreLignes - 1 || colonne != clavier->nombreColonnes || (*c == '\n' && c[1]))
+        return -EINVAL;
+    return 0;
+}
+
+static int changerDisposition(struct setrClavier *clavier, const char *texte){
+    // Construit une nouvelle disposition et la substitue à l'ancienne. Le balayage peut être
+    // en train de lire l'ancienne : elle n'est libérée qu'après une période de grâce RCU.
+    // Les nouveaux codes sont annoncés au sous-système input. Une touche enfoncée pendant
+    // le changement est relâchée avec son nouveau code : il vaut mieux changer la
+    // disposition lorsque le clavier est au repos.
+    struct dispositionClavier *nouvelle, *ancienne;
+    unsigned int ligne, colonne;
+    int ok;
+
+    nouvelle = kzalloc(sizeof(*nouvelle), GFP_KERNEL);
+    if(!nouvelle)
+        return -ENOMEM;
+    ok = lireDisposition(clavier, texte, nouvelle);
+    if(ok){
+        kfree(nouvelle);
+        return ok;
+    }
+
+    mutex_lock(&verrouDispositions);
+    if(clavier->clavierInput){
+        for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+            for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+                input_set_capability(clavier->clavierInput, EV_KEY, nouvelle->codes[ligne * BITS_PAR_LIGNE + colonne]);
+    }
+    ancienne = rcu_replace_pointer(clavier->disposition, nouvelle, lockdep_is_held(&verrouDispositions));
+    mutex_unlock(&verrouDispositions);
+    if(ancienne)
+        kfree_rcu(ancienne, rcu);
+    return 0;
+}
+
+static void attendreEtablissement(u32 delaiNs){
+    // Les délais courts sont une attente active à la nanoseconde; au-delà de 10 us, on laisse
+    // plutôt le processeur (le balayage se fait toujours dans un thread)
+    if(delaiNs < 10 * NSEC_PER_USEC)
+        ndelay(delaiNs);
+    else
+        fsleep(DIV_ROUND_UP(delaiNs, NSEC_PER_USEC));
+}
+
+unsigned long lireColonnes(struct setrClavier *clavier){
+    unsigned long colonnes = 0;
+
+    gpiod_get_array_value_cansleep(clavier->gpioLecture->ndescs, clavier->gpioLecture->desc,
+                                   clavier->gpioLecture->info, &colonnes);
+    return colonnes & clavier->masqueColonnes;
+}
+
+void poserMotifRepos(struct setrClavier *clavier){
+    // Met toutes les lignes à 1 (modes irq et hybrid), pour réarmer les interruptions, et
+    // attend que les colonnes se stabilisent : lireColonnes donne ensuite les colonnes des
+    // touches enfoncées (voir activerIrqColonnes)
+    u32 delaiNs = 0;
+    unsigned int ligne;
+
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, &clavier->motifRepos);
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+        delaiNs = max(delaiNs, READ_ONCE(clavier->delaisEtablissementNs[ligne]));
+    attendreEtablissement(delaiNs);
+}
+
+// Interface GPIO de balayerMatrice (voir setr_commun.h) pour les GPIO du clavier.
+// Lorsque les GPIO d'un groupe appartiennent au même contrôleur et que leur numéro matériel
+// correspond à leur index, gpiolib utilise son chemin rapide (gpio_array_info) et n'accède
+// au contrôleur qu'une seule fois pour tout le groupe.
+// Le balayage se fait toujours dans un thread (thread de polling ou thread d'IRQ) :
+// les variantes _cansleep sont donc permises, quel que soit le contrôleur GPIO.
+static void ecrireLignesGpio(void *contexte, const unsigned long *motif){
+    struct setrClavier *clavier = contexte;
+
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, (unsigned long *)motif);
+}
+
+static unsigned long lireColonnesGpio(void *contexte){
+    return lireColonnes(contexte);
+}
+
+static void attendreGpio(void *contexte, u32 delaiNs){
+    attendreEtablissement(delaiNs);
+}
+
+u64 lireMatrice(struct setrClavier *clavier){
+    // Balaye la matrice et retourne son état brut (un bit par touche, voir BIT_TOUCHE)
+    return balayerMatrice(&clavier->gpio, clavier->nombreLignes, clavier->masqueColonnes,
+                          motifsLignes, clavier->delaisEtablissementNs);
+}
+
+static s64 mesurerEtablissement(struct setrClavier *clavier, unsigned long *motifAvant, unsigned long *motifLigne){
+    // Mesure le temps que mettent les colonnes à se stabiliser lorsqu'on passe du patron
+    // motifAvant au patron motifLigne, comme le fait lireMatrice. On lit d'abord, après une longue
+    // attente, les colonnes avant et après le changement; si elles sont identiques (aucune
+    // touche enfoncée ne fait de différence), il n'y a rien à mesurer et on retourne -1.
+    // Sinon, on refait le changement et on lit les colonnes en boucle : le temps
+    // d'établissement est l'instant de la première des LECTURES_STABLES lectures consécutives
+    // donnant la valeur finale. Une première lecture déjà stable donne donc 0.
+    unsigned long avant, apres, colonnes;
+    unsigned int stables = 0;
+    u64 debut, instant, etablissement = 0;
+
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, motifAvant);
+    fsleep(ATTENTE_REFERENCE_US);
+    avant = lireColonnes(clavier);
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, motifLigne);
+    fsleep(ATTENTE_REFERENCE_US);
+    apres = lireColonnes(clavier);
+    if(avant == apres)
+        return -1;
+
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, motifAvant);
+    fsleep(ATTENTE_REFERENCE_US);
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, motifLigne);
+    debut = ktime_get_ns();
+    while(stables < LECTURES_STABLES){
+        instant = ktime_get_ns() - debut;
+        // Une touche relâchée pendant la mesure ne donnerait jamais la valeur finale
+        if(instant > ATTENTE_REFERENCE_US * NSEC_PER_USEC)
+            return -1;
+        colonnes = lireColonnes(clavier);
+        if(colonnes != apres)
+            stables = 0;
+        else if(stables++ == 0)
+            etablissement = instant;
+    }
+    return etablissement;
+}
+
+static void calibrerEtablissement(struct setrClavier *clavier){
+    // Mesure le temps d'établissement de chaque ligne (voir mesurerEtablissement) et choisit
+    // le délai minimal sûr : la plus longue mesure de la ligne, plus margeEtablissement %.
+    // Seules les lignes voisines d'une touche enfoncée (la sienne et la suivante) changent
+    // les colonnes; les autres reçoivent le délai de la ligne la plus lente, le câblage
+    // étant le même. Si aucune ligne n'a pu être mesurée, les délais ne changent pas et
+    // resultatCalibration vaut -ENODATA.
+    // L'appelant doit avoir un accès exclusif aux GPIO de ce clavier : balayage pas encore
+    // commencé ou suspendu, ou écarté le temps de la calibration (voir demanderCalibration).
+    struct mesureEtablissement *mesure;
+    unsigned int ligne, essai, lignesMesurees = 0;
+    unsigned long repos = modeBalayage == MODE_POLLING ? 0 : clavier->motifRepos;
+    u64 plusLente = 0;
+    s64 resultat;
+
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++){
+        mesure = &clavier->mesuresEtablissement[ligne];
+        memset(mesure, 0, sizeof(*mesure));
+        mesure->minNs = U64_MAX;
+        for(essai = 0; essai < ESSAIS_ETABLISSEMENT; essai++){
+            // Comme dans lireMatrice, on arrive à la ligne depuis la précédente
+            resultat = mesurerEtablissement(clavier,
+                                            &motifsLignes[(ligne + clavier->nombreLignes - 1) % clavier->nombreLignes],
+                                            &motifsLignes[ligne]);
+            mesure->essais++;
+            if(resultat < 0)
+                continue;
+            mesure->observations++;
+            mesure->sommeNs += resultat;
+            mesure->minNs = min_t(u64, mesure->minNs, resultat);
+            mesure->maxNs = max_t(u64, mesure->maxNs, resultat);
+        }
+        if(mesure->observations){
+            lignesMesurees++;
+            plusLente = max(plusLente, mesure->maxNs);
+        }
+        else{
+            mesure->minNs = 0;
+        }
+    }
+
+    clavier->resultatCalibration = lignesMesurees ? 0 : -ENODATA;
+    if(lignesMesurees){
+        for(ligne = 0; ligne < clavier->nombreLignes; ligne++){
+            mesure = &clavier->mesuresEtablissement[ligne];
+            WRITE_ONCE(clavier->delaisEtablissementNs[ligne],
+                       min_t(u64, div_u64((mesure->observations ? mesure->maxNs : plusLente) * (100 + margeEtablissement), 100),
+                             U32_MAX));
+        }
+        printk(KERN_INFO "SETR_CLAVIER : Calibration de %s : %u ligne(s) mesuree(s), etablissement le plus long %llu ns\n",
+               dev_name(clavier->parent), lignesMesurees, plusLente);
+    }
+    else{
+        printk(KERN_INFO "SETR_CLAVIER : Calibration de %s : aucune touche enfoncee, delais inchanges\n",
+               dev_name(clavier->parent));
+    }
+
+    // On remet les lignes dans l'état attendu par le mode de balayage, et la calibration
+    // ne doit pas compter dans la latence entre l'interruption et le balayage
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, &repos);
+    clavier->instantIrq = 0;
+}
+
+static int demanderCalibration(struct setrClavier *clavier){
+    // Calibre le clavier et retourne resultatCalibration. La calibration pilote les GPIO :
+    // on écarte d'abord le balayage de ce clavier seulement, sans attendre son prochain tour
+    // ni arrêter celui des autres claviers.
+    //  - balayage suspendu : rien ne pilote les GPIO, on calibre directement;
+    //  - mode irq : verrouBalayage retient le thread d'IRQ de ce clavier;
+    //  - modes polling et hybrid : le clavier est retiré du thread de polling, qui continue
+    //      de balayer les autres, puis lui est rendu (ajouterPolling le balaye aussitôt).
+    // verrouUtilisateurs empêche le balayage de reprendre ou d'être suspendu entre-temps;
+    // il n'est détenu que le temps de la calibration.
+    int ok;
+
+    mutex_lock(&verrouCalibration);
+    mutex_lock(&clavier->verrouUtilisateurs);
+    if(!clavier->balayageActif){
+        calibrerEtablissement(clavier);
+    }
+    else if(modeBalayage == MODE_IRQ){
+        mutex_lock(&clavier->verrouBalayage);
+        calibrerEtablissement(clavier);
+        mutex_unlock(&clavier->verrouBalayage);
+    }
+    else{
+        retirerPolling(clavier);
+        calibrerEtablissement(clavier);
+        ajouterPolling(clavier);
+    }
+    ok = clavier->resultatCalibration;
+    mutex_unlock(&clavier->verrouUtilisateurs);
+    mutex_unlock(&verrouCalibration);
+    return ok;
+}
+
+// Histogrammes de latence de chaque clavier (struct histogramme), exposés dans debugfs
+// (/sys/kernel/debug/setrclavierN/)
+void ajouterLatence(struct histogramme *histo, s64 latenceNs){
+    // Le balayage est le seul écrivain de ses histogrammes, mais chaque lecteur a son propre
+    // mutex : plusieurs read() peuvent alimenter histoEnfilageLecture en même temps. Chaque
+    // compteur est donc atomique, sans verrou. Une lecture concurrente depuis debugfs peut
+    // au pire voir des compteurs décalés d'une unité.
+    unsigned int classe;
+    s64 max;
+
+    if(latenceNs < 0)
+        latenceNs = 0;
+    classe = min_t(unsigned int, ilog2((u64)latenceNs | 1), NOMBRE_CLASSES_HISTO - 1);
+    atomic_long_inc(&histo->classes[classe]);
+    atomic_long_inc(&histo->total);
+    atomic64_add(latenceNs, &histo->sommeNs);
+    max = atomic64_read(&histo->maxNs);
+    while(latenceNs > max && !atomic64_try_cmpxchg(&histo->maxNs, &max, latenceNs))
+        ;
+}
+
+static int histogramme_show(struct seq_file *s, void *inutilise){
+    struct histogramme *histo = s->private;
+    unsigned long total = atomic_long_read(&histo->total), nombre;
+    unsigned int classe;
+
+    seq_printf(s, "total %lu, moyenne %llu ns, max %llu ns\n", total,
+               total ? div64_u64(atomic64_read(&histo->sommeNs), total) : 0,
+               (u64)atomic64_read(&histo->maxNs));
+    for(classe = 0; classe < NOMBRE_CLASSES_HISTO; classe++){
+        nombre = atomic_long_read(&histo->classes[classe]);
+        if(nombre)
+            seq_printf(s, ">= %12llu ns : %lu\n", classe ? 1ULL << classe : 0ULL, nombre);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(histogramme);
+
+static void viderHistogramme(struct histogramme *histo){
+    // Remet chaque compteur à zéro par l'API atomique : le balayage, les interruptions et
+    // les lecteurs peuvent continuer d'y ajouter des latences pendant ce temps
+    unsigned int classe;
+
+    for(classe = 0; classe < NOMBRE_CLASSES_HISTO; classe++)
+        atomic_long_set(&histo->classes[classe], 0);
+    atomic_long_set(&histo->total, 0);
+    atomic64_set(&histo->sommeNs, 0);
+    atomic64_set(&histo->maxNs, 0);
+}
+
+static ssize_t reinitialiserHistogrammes(struct file *filep, const char __user *buffer, size_t len, loff_t *offset){
+    // N'importe quelle écriture dans le fichier "reinitialiser" remet les histogrammes à zéro
+    struct setrClavier *clavier = filep->private_data;
+
+    viderHistogramme(&clavier->histoIrqBalayage);
+    viderHistogramme(&clavier->histoBalayageEnfilage);
+    viderHistogramme(&clavier->histoEnfilageLecture);
+    viderHistogramme(&clavier->histoGigue);
+    return len;
+}
+
+static const struct file_operations reinitialiserFops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,            // private_data : le clavier (voir creerDebugfs)
+    .write = reinitialiserHistogrammes,
+};
+
+static ssize_t injecterEvenements(struct file *filep, const char __user *buffer, size_t len, loff_t *offset);
+
+static const struct file_operations injecterFops = {
+    .owner = THIS_MODULE,
+    .open = simple_open,            // private_data : le clavier (voir creerDebugfs)
+    .write = injecterEvenements,
+};
+
+static int etablissement_show(struct seq_file *s, void *inutilise){
+    // Délai choisi et mesures de la dernière calibration, pour chaque ligne
+    struct setrClavier *clavier = s->private;
+    struct mesureEtablissement *mesure;
+    unsigned int ligne;
+
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++){
+        mesure = &clavier->mesuresEtablissement[ligne];
+        seq_printf(s, "ligne %u : delai %u ns, %u/%u mesures, min %llu ns, moyenne %llu ns, max %llu ns\n",
+                   ligne, READ_ONCE(clavier->delaisEtablissementNs[ligne]), mesure->observations, mesure->essais,
+                   mesure->minNs, mesure->observations ? div_u64(mesure->sommeNs, mesure->observations) : 0,
+                   mesure->maxNs);
+    }
+    return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(etablissement);
+
+static void creerDebugfs(struct setrClavier *clavier){
+    // Les erreurs de debugfs ne sont pas fatales : le pilote fonctionne sans ses statistiques.
+    // Chaque clavier a son propre répertoire, du même nom que son fichier dans /dev.
+    clavier->repertoireDebug = debugfs_create_dir(dev_name(clavier->setrDevice), NULL);
+    if(modeBalayage != MODE_POLLING)
+        debugfs_create_file("latence_irq_balayage", 0444, clavier->repertoireDebug, &clavier->histoIrqBalayage, &histogramme_fops);
+    debugfs_create_file("latence_balayage_enfilage", 0444, clavier->repertoireDebug, &clavier->histoBalayageEnfilage, &histogramme_fops);
+    debugfs_create_file("latence_enfilage_lecture", 0444, clavier->repertoireDebug, &clavier->histoEnfilageLecture, &histogramme_fops);
+    if(modeBalayage != MODE_IRQ)
+        debugfs_create_file("gigue_balayage", 0444, clavier->repertoireDebug, &clavier->histoGigue, &histogramme_fops);
+    debugfs_create_file("reinitialiser", 0200, clavier->repertoireDebug, clavier, &reinitialiserFops);
+    debugfs_create_file("etablissement", 0444, clavier->repertoireDebug, clavier, &etablissement_fops);
+    if(activerInjection)
+        debugfs_create_file("injecter", 0200, clavier->repertoireDebug, clavier, &injecterFops);
+}
+
+ktime_t noterDebutBalayage(struct setrClavier *clavier){
+    // Appelée par chaque mode au début d'un balayage : sert de référence à la latence
+    // d'ajout dans le buffer et, si le balayage fait suite à une interruption, mesure
+    // le délai depuis celle-ci. Retourne l'instant du début du balayage.
+    this_cpu_inc(clavier->compteurs->balayages);
+    clavier->debutBalayage = ktime_get();
+    trace_setr_balayage(clavier->dernierEtat);
+    if(clavier->instantIrq){
+        ajouterLatence(&clavier->histoIrqBalayage, ktime_to_ns(ktime_sub(clavier->debutBalayage, clavier->instantIrq)));
+        clavier->instantIrq = 0;
+    }
+    return clavier->debutBalayage;
+}
+
+static u32 calculerQueue(struct setrClavier *clavier, u32 tete){
+    // Retourne la position du lecteur le plus en retard. Les événements qu'aucun read() n'a
+    // encore atteints (à partir de positionLue) sont conservés pour le prochain lecteur, même
+    // si aucun fichier n'est ouvert : ils comptent donc comme un lecteur de plus.
+    // Un fichier qui n'a jamais lu (journal projeté par mmap seulement, ou SETR_IOCTL_INSTANTANE)
+    // n'avancerait jamais : il n'est pas compté, et lecteurActif indique s'il reste un vrai lecteur.
+    // Coûte O(nombre de lecteurs); niveauTampon ne l'appelle donc que lorsque c'est utile.
+    struct lecteurClavier *lecteur;
+    u32 queue = READ_ONCE(clavier->positionLue), position;
+    bool actif = false;
+
+    spin_lock(&clavier->verrouLecteurs);
+    list_for_each_entry(lecteur, &clavier->lecteurs, lien){
+        if(!READ_ONCE(lecteur->actif))
+            continue;
+        actif = true;
+        position = READ_ONCE(lecteur->position);
+        if(tete - position > tete - queue)
+            queue = position;
+    }
+    spin_unlock(&clavier->verrouLecteurs);
+    clavier->lecteurActif = actif;
+    return queue;
+}
+
+static u32 niveauTampon(struct setrClavier *clavier, bool exact){
+    // Nombre d'événements pas encore lus par le lecteur le plus en retard, au plus
+    // tailleBuffer - 1 (voir sauterEcrases). Les lecteurs et positionLue ne font qu'avancer,
+    // et un nouveau lecteur commence à positionLue : queueConnue ne peut donc que surestimer
+    // ce niveau. Seul un fichier qui lit pour la première fois peut être plus en retard que
+    // queueConnue : il le signale par nouveauLecteur.
+    // On ne recalcule la vraie queue que si le niveau estimé atteint un seuil qui compte
+    // (tampon plein ou nouveau maximum), ou si l'appelant exige une valeur exacte.
+    u32 niveau = clavier->teteTampon - clavier->queueConnue;
+
+    if(exact || READ_ONCE(clavier->nouveauLecteur) || niveau >= tailleBuffer - 1 || niveau >= clavier->niveauMax){
+        WRITE_ONCE(clavier->nouveauLecteur, false);
+        clavier->queueConnue = calculerQueue(clavier, clavier->teteTampon);
+        niveau = clavier->teteTampon - clavier->queueConnue;
+    }
+    return min_t(u32, niveau, tailleBuffer - 1);
+}
+
+bool tamponSature(struct setrClavier *clavier){
+    // Politique backpressure : le balayage est reporté tant qu'un balayage complet
+    // (au plus un événement par touche) ne pourrait pas être conservé en entier.
+    // Les touches restent dans l'état de la matrice et seront vues à la reprise; seule
+    // une touche pressée et relâchée pendant la suspension peut être perdue.
+    // Sans lecteur actif (voir calculerQueue), personne ne libérerait de place : on continue
+    // de balayer pour le journal et l'instantané, et le tampon garde ses plus anciens événements.
+    u32 niveau;
+
+    if(READ_ONCE(clavier->politique) != POLITIQUE_SUSPENDRE)
+        return false;
+    niveau = niveauTampon(clavier, true);
+    if(!clavier->lecteurActif)
+        return false;
+    if(tailleBuffer - 1 - niveau >= min_t(u32, clavier->nombreLignes * clavier->nombreColonnes, tailleBuffer - 1))
+        return false;
+    WRITE_ONCE(clavier->suspensions, clavier->suspensions + 1);
+    return true;
+}
+
+static void ajouterAuTampon(struct setrClavier *clavier, const struct setr_evenement *evenement){
+    // Ajoute un événement dans le tampon de diffusion. Si le lecteur le plus en retard n'a
+    // plus de place, la politique choisie s'applique : l'événement est ignoré (drop-newest,
+    // et backpressure si un balayage dépasse malgré tout), ou le plus ancien est écrasé
+    // (drop-oldest). Dans les deux cas, l'événement perdu est compté dans perdus.
+    // Comme le balayage est l'unique producteur, aucun verrou n'est nécessaire, et il
+    // n'attend jamais les lecteurs : c'est à eux de détecter qu'ils ont été dépassés
+    // (voir copierEnAttente). Les lecteurs sont réveillés une seule fois à la fin du balayage
+    // (voir publierEvenements).
+    ktime_t maintenant = ktime_get();
+    u32 niveau = niveauTampon(clavier, false);
+
+    if(niveau >= tailleBuffer - 1){
+        WRITE_ONCE(clavier->perdus, clavier->perdus + 1);
+        if(READ_ONCE(clavier->politique) != POLITIQUE_ECRASER_ANCIEN)
+            return;
+    }
+    else if(niveau + 1 > clavier->niveauMax){
+        WRITE_ONCE(clavier->niveauMax, niveau + 1);
+    }
+
+    ecrireTampon(clavier->tampon, tailleBuffer, &clavier->teteTampon, evenement, ktime_to_ns(maintenant));
+    this_cpu_inc(clavier->compteurs->enfiles);
+
+    ajouterLatence(&clavier->histoBalayageEnfilage, ktime_to_ns(ktime_sub(maintenant, clavier->debutBalayage)));
+    trace_setr_enfilage(evenement->caractere, ktime_to_ns(ktime_sub(maintenant, clavier->debutBalayage)));
+}
+
+static void relireEtat(struct setrClavier *clavier){
+    // Appelée à la reprise du balayage, alors que rien d'autre ne pilote les GPIO : l'état de
+    // la matrice est relu et devient la référence du balayage, sans émettre d'événement.
+    // Une touche enfoncée pendant la suspension ne produit donc pas de pression fantôme.
+    // Une touche relâchée pendant la suspension n'est signalée qu'au sous-système input,
+    // qui la croirait sinon toujours enfoncée.
+    struct dispositionClavier *disposition;
+    unsigned long repos = modeBalayage == MODE_POLLING ? 0 : clavier->motifRepos;
+    u64 matrice, relachees;
+    unsigned int bit;
+
+    // Les touches ambiguës (voir eliminerFantomes) sont considérées relâchées jusqu'à ce
+    // que la matrice redevienne lisible
+    matrice = filtrerFantomes(0, lireMatrice(clavier), clavier->nombreLignes, &clavier->masqueAmbigu);
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, &repos);
+
+    relachees = clavier->dernierEtat & ~matrice;
+    if(clavier->clavierInput && relachees){
+        rcu_read_lock();
+        disposition = rcu_dereference(clavier->disposition);
+        while(relachees){
+            bit = __ffs64(relachees);
+            relachees &= relachees - 1;
+            input_report_key(clavier->clavierInput, disposition->codes[bit], 0);
+        }
+        rcu_read_unlock();
+        input_sync(clavier->clavierInput);
+    }
+
+    clavier->dernierEtat = matrice;
+    memset(&clavier->antirebond, 0, sizeof(clavier->antirebond));
+    while(matrice){
+        bit = __ffs64(matrice);
+        matrice &= matrice - 1;
+        clavier->antirebond.etats[bit] = TOUCHE_ENFONCEE;
+    }
+    clavier->toucheRepetee = -1;
+    clavier->prochaineRepetition = KTIME_MAX;
+    publierInstantane(clavier, ktime_get());
+}
+
+static void reprendreBalayage(struct setrClavier *clavier){
+    // L'appelant détient verrouUtilisateurs. En mode hybride, le thread de polling balaye
+    // le clavier aussitôt, puis retourne à l'attente d'une interruption.
+    relireEtat(clavier);
+    WRITE_ONCE(clavier->balayageActif, true);
+    if(modeBalayage != MODE_POLLING)
+        reprendreIrq(clavier);
+    if(modeBalayage != MODE_IRQ)
+        ajouterPolling(clavier);
+    printk(KERN_INFO "SETR_CLAVIER : Reprise du balayage de %s\n", dev_name(clavier->parent));
+}
+
+static void suspendreBalayage(struct setrClavier *clavier){
+    // L'appelant détient verrouUtilisateurs. Une fois retiré, le clavier n'est plus touché par
+    // le thread de polling (voir retirerPolling) ni par les interruptions (voir suspendreIrq) :
+    // on peut alors mettre toutes ses lignes à 0, pour qu'aucun courant ne traverse une touche
+    // tenue pendant la suspension.
+    unsigned long repos = 0;
+
+    WRITE_ONCE(clavier->balayageActif, false);
+    if(modeBalayage != MODE_IRQ)
+        retirerPolling(clavier);
+    if(modeBalayage != MODE_POLLING)
+        suspendreIrq(clavier);
+    gpiod_set_array_value_cansleep(clavier->gpioEcriture->ndescs, clavier->gpioEcriture->desc,
+                                   clavier->gpioEcriture->info, &repos);
+    printk(KERN_INFO "SETR_CLAVIER : Suspension du balayage de %s\n", dev_name(clavier->parent));
+}
+
+static void ajouterUtilisateur(struct setrClavier *clavier){
+    // Le premier utilisateur (fichier ouvert ou périphérique input ouvert) relance le balayage,
+    // s'il est déjà prêt (voir setrclavier_probe)
+    mutex_lock(&clavier->verrouUtilisateurs);
+    if(clavier->utilisateurs++ == 0 && clavier->balayagePret && !clavier->balayageActif)
+        reprendreBalayage(clavier);
+    mutex_unlock(&clavier->verrouUtilisateurs);
+}
+
+static void retirerUtilisateur(struct setrClavier *clavier){
+    // Avec balayerSansLecteur=0, le dernier utilisateur suspend le balayage
+    mutex_lock(&clavier->verrouUtilisateurs);
+    if(--clavier->utilisateurs == 0 && clavier->balayageActif && !balayerSansLecteur)
+        suspendreBalayage(clavier);
+    mutex_unlock(&clavier->verrouUtilisateurs);
+}
+
+static int ouvertureInput(struct input_dev *clavierInput){
+    ajouterUtilisateur(input_get_drvdata(clavierInput));
+    return 0;
+}
+
+static void fermetureInput(struct input_dev *clavierInput){
+    retirerUtilisateur(input_get_drvdata(clavierInput));
+}
+
+static int creerClavierInput(struct setrClavier *clavier){
+    // Alloue et enregistre le périphérique input. Chaque touche du clavier
+    // est annoncée avec son code KEY_* (voir codeTouche).
+    struct dispositionClavier *disposition;
+    int ligne, colonne, ok;
+
+    clavier->clavierInput = input_allocate_device();
+    if(!clavier->clavierInput)
+        return -ENOMEM;
+
+    clavier->clavierInput->name = "Clavier SETR";
+    snprintf(clavier->phys, sizeof(clavier->phys), "%s/input0", dev_name(clavier->setrDevice));
+    clavier->clavierInput->phys = clavier->phys;
+    clavier->clavierInput->id.bustype = BUS_HOST;
+    clavier->clavierInput->dev.parent = clavier->setrDevice;
+    clavier->clavierInput->open = ouvertureInput;
+    clavier->clavierInput->close = fermetureInput;
+    input_set_drvdata(clavier->clavierInput, clavier);
+    mutex_lock(&verrouDispositions);
+    disposition = rcu_dereference_protected(clavier->disposition, lockdep_is_held(&verrouDispositions));
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+        for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+            input_set_capability(clavier->clavierInput, EV_KEY, disposition->codes[ligne * BITS_PAR_LIGNE + colonne]);
+    mutex_unlock(&verrouDispositions);
+
+    ok = input_register_device(clavier->clavierInput);
+    if(ok){
+        input_free_device(clavier->clavierInput);
+        clavier->clavierInput = NULL;
+    }
+    return ok;
+}
+
+static void diffuserEvenement(struct setrClavier *clavier, const struct setr_evenement *evenement){
+    // Ajoute un événement au tampon de diffusion, puis au journal partagé s'il y a de la place.
+    // Réservée au producteur : le balayage, ou une injection sous son verrou (voir verrouillerProducteur).
+    ajouterAuTampon(clavier, evenement);
+
+    // L'en-tête est accessible en écriture par l'application : on ne se fie donc qu'à nos
+    // copies privées de la tête et de la capacité pour calculer la position de l'entrée.
+    // La lecture de queue se fait avec une barrière acquire, pour ne pas écraser une
+    // entrée encore en lecture.
+    if(clavier->teteJournal - smp_load_acquire(&clavier->journal->queue) >= tailleJournal){
+        clavier->journal->perdus++;
+    }
+    else{
+        clavier->evenements[clavier->teteJournal & (tailleJournal - 1)] = *evenement;
+        // L'événement doit être entièrement écrit avant que la nouvelle tête ne soit visible
+        clavier->teteJournal++;
+        smp_store_release(&clavier->journal->tete, clavier->teteJournal);
+    }
+}
+
+void ajouterEvenement(struct setrClavier *clavier, int ligne, int colonne, int etat, ktime_t horodatage, bool premier){
+    // Enregistre une pression (etat = 1), un relâchement (etat = 0) ou une répétition
+    // (etat = ETAT_REPETITION, voir emettreRepetition) détecté pendant un balayage :
+    // 1) L'événement est ajouté au tampon de diffusion lu par read() et SETR_IOCTL_VIDER
+    // 2) Il est écrit dans le journal partagé par mmap, s'il y a de la place
+    // 3) Il est transmis au sous-système input, s'il est activé
+    // Le tampon et le journal reçoivent le même numéro de séquence.
+    //
+    // L'horodatage est celui du début du balayage, et non celui de la lecture par l'application.
+    // Pour le sous-système input, il n'est fixé qu'une fois par balayage puisque tous les
+    // événements d'un balayage sont regroupés dans un même SYN_REPORT.
+    struct dispositionClavier *disposition;
+    unsigned int bit = ligne * BITS_PAR_LIGNE + colonne;
+    enum classeTouche classe;
+    struct setr_evenement evenement = {
+        .horodatageNs = ktime_to_ns(horodatage),
+        .sequence = clavier->sequenceCourante++,
+        .ligne = ligne,
+        .colonne = colonne,
+        .type = etat == ETAT_BLOCAGE ? SETR_EVENEMENT_BLOCAGE :
+                etat == ETAT_REPETITION ? SETR_EVENEMENT_REPETITION :
+                etat ? SETR_EVENEMENT_PRESSION : SETR_EVENEMENT_RELACHEMENT,
+    };
+
+    // Le caractère et le code de la touche sont lus directement dans la disposition courante
+    rcu_read_lock();
+    disposition = rcu_dereference(clavier->disposition);
+    evenement.code = disposition->codes[bit];
+    evenement.caractere = disposition->caracteres[bit];
+    classe = disposition->classes[bit];
+    rcu_read_unlock();
+
+    // La répétition automatique suit la dernière touche enfoncée, et cesse lorsqu'elle est
+    // relâchée. Les répétitions suivent une grille fixe à partir de la première : on ne
+    // rattrape pas celles qu'un balayage en retard aurait manquées. Un accord bloqué
+    // ne change rien : les touches retenues gardent leur état.
+    if(etat == ETAT_REPETITION){
+        clavier->prochaineRepetition = ktime_add_ms(clavier->prochaineRepetition, READ_ONCE(clavier->periodeRepetitionMs[classe]));
+        if(!ktime_after(clavier->prochaineRepetition, horodatage))
+            clavier->prochaineRepetition = ktime_add_ms(horodatage, READ_ONCE(clavier->periodeRepetitionMs[classe]));
+    }
+    else if(etat == 1){
+        clavier->toucheRepetee = bit;
+        clavier->prochaineRepetition = READ_ONCE(clavier->delaiRepetitionMs[classe]) ?
+                                       ktime_add_ms(horodatage, READ_ONCE(clavier->delaiRepetitionMs[classe])) : KTIME_MAX;
+    }
+    else if(etat == 0 && bit == clavier->toucheRepetee){
+        clavier->toucheRepetee = -1;
+        clavier->prochaineRepetition = KTIME_MAX;
+    }
+
+    trace_setr_touche(ligne, colonne, etat, evenement.code);
+    diffuserEvenement(clavier, &evenement);
+
+    if(clavier->clavierInput){
+        if(premier)
+            input_set_timestamp(clavier->clavierInput, horodatage);
+        // input_report_key ramènerait la répétition (2) à une pression (1)
+        if(etat != ETAT_BLOCAGE)
+            input_event(clavier->clavierInput, EV_KEY, evenement.code, etat);
+    }
+}
+
+bool eliminerFantomes(struct setrClavier *clavier, u64 *matrice, ktime_t horodatage, bool premier){
+    // Appelée par chaque mode avec l'état brut de la matrice, avant de le comparer à dernierEtat.
+    // Les touches ambiguës (voir filtrerFantomes) y gardent leur état stable : une touche
+    // fantôme n'est jamais signalée, et une vraie touche prise dans le rectangle n'est
+    // signalée qu'une fois la matrice redevenue lisible (par exemple, lorsqu'une des autres est
+    // relâchée). Ailleurs dans la matrice, les touches continuent d'être signalées.
+    // Un accord bloqué est signalé une seule fois, lorsque des touches deviennent ambiguës.
+    // Retourne vrai si un événement a été émis.
+    u64 ambigues, nouvelles;
+    unsigned int bit;
+
+    *matrice = filtrerFantomes(clavier->dernierEtat, *matrice, clavier->nombreLignes, &ambigues);
+    nouvelles = ambigues & ~clavier->masqueAmbigu;
+    clavier->masqueAmbigu = ambigues;
+    if(!nouvelles)
+        return false;
+
+    bit = __ffs64(nouvelles);
+    WRITE_ONCE(clavier->blocages, clavier->blocages + 1);
+    ajouterEvenement(clavier, bit / BITS_PAR_LIGNE, bit % BITS_PAR_LIGNE, ETAT_BLOCAGE, horodatage, premier);
+    return true;
+}
+
+bool emettreRepetition(struct setrClavier *clavier, ktime_t maintenant, bool premier){
+    // Appelée par le balayage après les événements qu'il a détectés : si l'échéance de la
+    // touche répétée est atteinte, on émet une répétition (voir ajouterEvenement) et on
+    // retourne vrai. Comme la répétition est émise par le balayage lui-même, la touche est
+    // toujours enfoncée à ce moment, et le tampon garde un seul producteur. Une touche en
+    // cours de relâchement (antirebond du mode irq) n'est plus répétée.
+    if(ktime_before(maintenant, clavier->prochaineRepetition))
+        return false;
+    if(clavier->antirebond.masqueTransition & BIT_ULL(clavier->toucheRepetee))
+        return false;
+    ajouterEvenement(clavier, clavier->toucheRepetee / BITS_PAR_LIGNE, clavier->toucheRepetee % BITS_PAR_LIGNE,
+                     ETAT_REPETITION, maintenant, premier);
+    return true;
+}
+
+void publierEvenements(struct setrClavier *clavier){
+    // Appelée à la fin d'un balayage ayant détecté au moins un changement :
+    // on termine le paquet d'événements input et on réveille les lecteurs
+    // (read bloquant, poll/select/epoll et SIGIO) une seule fois.
+    if(clavier->clavierInput)
+        input_sync(clavier->clavierInput);
+    wake_up_interruptible(&clavier->fileAttente);
+    kill_fasync(&clavier->fileAsync, SIGIO, POLL_IN);
+}
+
+void publierInstantane(struct setrClavier *clavier, ktime_t horodatage){
+    // Appelée par le balayage une fois dernierEtat à jour (et à la reprise, voir relireEtat).
+    // L'instantané n'a qu'un écrivain à la fois; les lecteurs (SETR_IOCTL_INSTANTANE et
+    // l'attribut etat) ne prennent aucun verrou et recommencent leur copie si elle a croisé
+    // une écriture (voir lireInstantane) : ils ne retardent donc jamais le balayage.
+    // La préemption est désactivée pendant l'écriture, pour qu'un lecteur ne puisse pas
+    // tourner en boucle derrière un écrivain préempté.
+    preempt_disable();
+    write_seqcount_begin(&clavier->compteurInstantane);
+    clavier->instantane.touches = clavier->dernierEtat;
+    clavier->instantane.horodatageNs = ktime_to_ns(horodatage);
+    clavier->instantane.sequence = clavier->sequenceCourante;
+    clavier->instantane.balayages++;
+    write_seqcount_end(&clavier->compteurInstantane);
+    preempt_enable();
+}
+
+static void lireInstantane(struct setrClavier *clavier, struct setr_instantane *instantane){
+    unsigned int debut;
+
+    do{
+        debut = read_seqcount_begin(&clavier->compteurInstantane);
+        *instantane = clavier->instantane;
+    }while(read_seqcount_retry(&clavier->compteurInstantane, debut));
+}
+
+static void verrouillerProducteur(struct setrClavier *clavier){
+    // Le balayage est l'unique producteur du tampon et du journal. Pour y ajouter des
+    // événements d'ailleurs, on prend le verrou sous lequel le mode choisi balaye ce clavier :
+    // celui du thread d'IRQ en mode irq, celui du thread de polling sinon.
+    if(modeBalayage == MODE_IRQ)
+        mutex_lock(&clavier->verrouBalayage);
+    else
+        verrouillerPolling();
+}
+
+static void deverrouillerProducteur(struct setrClavier *clavier){
+    if(modeBalayage == MODE_IRQ)
+        mutex_unlock(&clavier->verrouBalayage);
+    else
+        deverrouillerPolling();
+}
+
+static void injecterLot(struct setrClavier *clavier, const struct setr_injection *injection, u32 nombre){
+    // Appelée sous verrouillerProducteur : ajoute nombre fois l'événement décrit par injection,
+    // comme le ferait un balayage (sans l'antirebond, la répétition ni le sous-système input),
+    // puis réveille les lecteurs une seule fois
+    struct dispositionClavier *disposition;
+    unsigned int bit = injection->ligne * BITS_PAR_LIGNE + injection->colonne;
+    struct setr_evenement evenement = {
+        .ligne = injection->ligne,
+        .colonne = injection->colonne,
+        .type = injection->type,
+    };
+    u32 i;
+
+    clavier->debutBalayage = ktime_get();
+    evenement.horodatageNs = ktime_to_ns(clavier->debutBalayage);
+    rcu_read_lock();
+    disposition = rcu_dereference(clavier->disposition);
+    evenement.code = disposition->codes[bit];
+    evenement.caractere = disposition->caracteres[bit];
+    rcu_read_unlock();
+
+    for(i = 0; i < nombre; i++){
+        evenement.sequence = clavier->sequenceCourante++;
+        diffuserEvenement(clavier, &evenement);
+    }
+    publierEvenements(clavier);
+}
+
+static ssize_t injecterEvenements(struct file *filep, const char __user *buffer, size_t len, loff_t *offset){
+    // Écriture dans le fichier debugfs "injecter" : chaque struct setr_injection est ajoutée
+    // rafale fois, par lots d'au plus LOT_INJECTION événements. Le balayage est bloqué pendant
+    // chaque lot, et reprend entre deux lots. Avec la politique backpressure, on attend comme
+    // le balayage que le tampon ait de la place (voir tamponSature), et un lot ne dépasse pas
+    // ce qu'un balayage peut ajouter : aucun événement injecté n'est alors perdu.
+    struct setrClavier *clavier = filep->private_data;
+    struct setr_injection injection;
+    size_t traites;
+    u32 restants, lot;
+    bool sature;
+
+    if(len % sizeof(injection))
+        return -EINVAL;
+
+    for(traites = 0; traites < len; traites += sizeof(injection)){
+        if(copy_from_user(&injection, buffer + traites, sizeof(injection)))
+            return traites ? traites : -EFAULT;
+        if(injection.ligne >= clavier->nombreLignes || injection.colonne >= clavier->nombreColonnes ||
+           injection.type > SETR_EVENEMENT_REPETITION)
+            return traites ? traites : -EINVAL;
+
+        restants = max_t(u32, injection.rafale, 1);
+        while(restants){
+            if(signal_pending(current))
+                return traites ? traites : -ERESTARTSYS;
+            lot = min_t(u32, restants, LOT_INJECTION);
+            if(READ_ONCE(clavier->politique) == POLITIQUE_SUSPENDRE)
+                lot = min_t(u32, lot, clavier->nombreLignes * clavier->nombreColonnes);
+
+            verrouillerProducteur(clavier);
+            sature = tamponSature(clavier);
+            if(!sature)
+                injecterLot(clavier, &injection, lot);
+            deverrouillerProducteur(clavier);
+
+            if(sature){
+                usleep_range(1000, 2000);
+                continue;
+            }
+            restants -= lot;
+            cond_resched();
+        }
+        if(injection.pauseUs)
+            fsleep(injection.pauseUs);
+    }
+    return len;
+}
+
+static int creerJournal(struct setrClavier *clavier){
+    // Alloue le journal partagé : une page d'en-tête suivie des événements. vmalloc_user
+    // retourne une zone initialisée à zéro et pouvant être projetée avec remap_vmalloc_range.
+    // tailleJournal a déjà été validée par setrclavier_init.
+    clavier->journal = vmalloc_user(PAGE_ALIGN(PAGE_SIZE + tailleJournal * sizeof(struct setr_evenement)));
+    if(!clavier->journal)
+        return -ENOMEM;
+
+    clavier->evenements = (struct setr_evenement *)((char *)clavier->journal + PAGE_SIZE);
+    clavier->journal->capacite = tailleJournal;
+    clavier->journal->tailleEvenement = sizeof(struct setr_evenement);
+    clavier->journal->decalage = PAGE_SIZE;
+    return 0;
+}
+
+// Attributs sysfs de chaque /dev/setrclavierN : la politique de débordement (modifiable)
+// et les compteurs. Les données du périphérique (dev_get_drvdata) sont le clavier.
+static ssize_t politique_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", nomsPolitiques[READ_ONCE(clavier->politique)]);
+}
+
+static ssize_t politique_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    int choix = sysfs_match_string(nomsPolitiques, buf);
+
+    if(choix < 0)
+        return choix;
+    WRITE_ONCE(clavier->politique, choix);
+    return len;
+}
+static DEVICE_ATTR_RW(politique);
+
+static ssize_t etat_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Touches enfoncées (bit ligne * 8 + colonne), horodatage du balayage, prochain numéro
+    // de séquence et nombre de balayages (voir struct setr_instantane)
+    struct setr_instantane instantane;
+
+    lireInstantane(dev_get_drvdata(dev), &instantane);
+    return sysfs_emit(buf, "0x%016llx %llu %u %u\n", instantane.touches, instantane.horodatageNs,
+                      instantane.sequence, instantane.balayages);
+}
+static DEVICE_ATTR_RO(etat);
+
+static unsigned long sommeCompteur(struct setrClavier *clavier, size_t decalage){
+    // Somme d'un champ de struct compteursClavier sur tous les processeurs. Les écrivains
+    // ne prennent aucun verrou : la somme peut manquer des incréments en cours, jamais
+    // en compter qui n'ont pas eu lieu.
+    unsigned long total = 0;
+    int cpu;
+
+    for_each_possible_cpu(cpu)
+        total += READ_ONCE(*(unsigned long *)((char *)per_cpu_ptr(clavier->compteurs, cpu) + decalage));
+    return total;
+}
+
+// Un attribut en lecture seule du groupe "compteurs" par champ de struct compteursClavier
+#define ATTRIBUT_COMPTEUR(nom, champ)                                                                   \
+static ssize_t compteur_##nom##_show(struct device *dev, struct device_attribute *attr, char *buf){     \
+    return sysfs_emit(buf, "%lu\n", sommeCompteur(dev_get_drvdata(dev),                                \
+                                                  offsetof(struct compteursClavier, champ)));           \
+}                                                                                                       \
+static struct device_attribute dev_attr_compteur_##nom = __ATTR(nom, 0444, compteur_##nom##_show, NULL)
+
+ATTRIBUT_COMPTEUR(balayages, balayages);
+ATTRIBUT_COMPTEUR(irq, irq);
+ATTRIBUT_COMPTEUR(irq_parasites, irqParasites);
+ATTRIBUT_COMPTEUR(rebonds, rebonds);
+ATTRIBUT_COMPTEUR(enfiles, enfiles);
+ATTRIBUT_COMPTEUR(lus, lus);
+ATTRIBUT_COMPTEUR(lectures_vides, lecturesVides);
+ATTRIBUT_COMPTEUR(tempetes, tempetes);
+
+static ssize_t repli_ms_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Temps passé en balayage périodique après une tempête d'interruptions, repli en cours compris
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    ktime_t debut = READ_ONCE(clavier->debutRepli);
+    u64 totalNs = READ_ONCE(clavier->repliNs);
+
+    if(debut)
+        totalNs += ktime_to_ns(ktime_sub(ktime_get(), debut));
+    return sysfs_emit(buf, "%llu\n", div_u64(totalNs, NSEC_PER_MSEC));
+}
+static DEVICE_ATTR_RO(repli_ms);
+
+static ssize_t perdus_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(clavier->perdus));
+}
+static DEVICE_ATTR_RO(perdus);
+
+static ssize_t niveau_max_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(clavier->niveauMax));
+}
+static DEVICE_ATTR_RO(niveau_max);
+
+static ssize_t suspensions_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(clavier->suspensions));
+}
+static DEVICE_ATTR_RO(suspensions);
+
+static ssize_t balayage_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%s\n", READ_ONCE(clavier->balayageActif) ? "actif" : "suspendu");
+}
+static DEVICE_ATTR_RO(balayage);
+
+static ssize_t blocages_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%lu\n", READ_ONCE(clavier->blocages));
+}
+static DEVICE_ATTR_RO(blocages);
+
+static ssize_t geometrie_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+
+    return sysfs_emit(buf, "%ux%u\n", clavier->nombreLignes, clavier->nombreColonnes);
+}
+static DEVICE_ATTR_RO(geometrie);
+
+static ssize_t touches_show(struct device *dev, struct device_attribute *attr, char *buf){
+    // Même format que le paramètre touches : les lignes sont séparées par des virgules
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    struct dispositionClavier *disposition;
+    unsigned int ligne, colonne;
+    int n = 0;
+
+    rcu_read_lock();
+    disposition = rcu_dereference(clavier->disposition);
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++){
+        if(ligne)
+            n += sysfs_emit_at(buf, n, ",");
+        for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+            n += sysfs_emit_at(buf, n, "%c", disposition->caracteres[ligne * BITS_PAR_LIGNE + colonne]);
+    }
+    rcu_read_unlock();
+    n += sysfs_emit_at(buf, n, "\n");
+    return n;
+}
+
+static ssize_t touches_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    int ok = changerDisposition(clavier, buf);
+
+    return ok ? ok : len;
+}
+static DEVICE_ATTR_RW(touches);
+
+// Répétition automatique de chaque classe de touches : "delai periode", en ms (délai nul :
+// pas de répétition). La nouvelle valeur s'applique à partir de la prochaine pression.
+static ssize_t afficherRepetition(struct setrClavier *clavier, enum classeTouche classe, char *buf){
+    return sysfs_emit(buf, "%u %u\n", READ_ONCE(clavier->delaiRepetitionMs[classe]),
+                      READ_ONCE(clavier->periodeRepetitionMs[classe]));
+}
+
+static ssize_t changerRepetition(struct setrClavier *clavier, enum classeTouche classe, const char *buf, size_t len){
+    unsigned int delai, periode;
+
+    if(sscanf(buf, "%u %u", &delai, &periode) != 2 || periode == 0)
+        return -EINVAL;
+    WRITE_ONCE(clavier->periodeRepetitionMs[classe], periode);
+    WRITE_ONCE(clavier->delaiRepetitionMs[classe], delai);
+    return len;
+}
+
+static ssize_t repetition_chiffres_show(struct device *dev, struct device_attribute *attr, char *buf){
+    return afficherRepetition(dev_get_drvdata(dev), CLASSE_CHIFFRE, buf);
+}
+
+static ssize_t repetition_chiffres_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    return changerRepetition(dev_get_drvdata(dev), CLASSE_CHIFFRE, buf, len);
+}
+static DEVICE_ATTR_RW(repetition_chiffres);
+
+static ssize_t repetition_fonctions_show(struct device *dev, struct device_attribute *attr, char *buf){
+    return afficherRepetition(dev_get_drvdata(dev), CLASSE_FONCTION, buf);
+}
+
+static ssize_t repetition_fonctions_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    return changerRepetition(dev_get_drvdata(dev), CLASSE_FONCTION, buf, len);
+}
+static DEVICE_ATTR_RW(repetition_fonctions);
+
+// Délai d'établissement de chaque ligne, en ns, séparés par des espaces. Peut être fixé à
+// la main, ou mesuré en écrivant 1 dans "calibrer" pendant qu'une touche est enfoncée.
+static ssize_t etablissement_ns_show(struct device *dev, struct device_attribute *attr, char *buf){
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    unsigned int ligne;
+    int n = 0;
+
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+        n += sysfs_emit_at(buf, n, "%s%u", ligne ? " " : "", READ_ONCE(clavier->delaisEtablissementNs[ligne]));
+    n += sysfs_emit_at(buf, n, "\n");
+    return n;
+}
+
+static ssize_t etablissement_ns_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    // Une seule valeur s'applique à toutes les lignes; sinon, il en faut une par ligne
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    u32 delais[NOMBRE_MAX_LIGNES];
+    unsigned int ligne, nombre = 0;
+    int n;
+
+    while(nombre < NOMBRE_MAX_LIGNES && sscanf(buf, "%u%n", &delais[nombre], &n) == 1){
+        buf += n;
+        nombre++;
+    }
+    if(nombre != 1 && nombre != clavier->nombreLignes)
+        return -EINVAL;
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+        WRITE_ONCE(clavier->delaisEtablissementNs[ligne], delais[nombre == 1 ? 0 : ligne]);
+    return len;
+}
+static DEVICE_ATTR_RW(etablissement_ns);
+
+static ssize_t calibrer_store(struct device *dev, struct device_attribute *attr, const char *buf, size_t len){
+    // Écrire 1 lance une calibration et attend son résultat (-ENODATA si aucune touche n'est enfoncée)
+    struct setrClavier *clavier = dev_get_drvdata(dev);
+    bool calibrer;
+    int ok;
+
+    if(kstrtobool(buf, &calibrer))
+        return -EINVAL;
+    if(!calibrer)
+        return len;
+    ok = demanderCalibration(clavier);
+    return ok ? ok : len;
+}
+static DEVICE_ATTR_WO(calibrer);
+
+static struct attribute *setrClavier_attrs[] = {
+    &dev_attr_geometrie.attr,
+    &dev_attr_balayage.attr,
+    &dev_attr_etablissement_ns.attr,
+    &dev_attr_calibrer.attr,
+    &dev_attr_touches.attr,
+    &dev_attr_repetition_chiffres.attr,
+    &dev_attr_repetition_fonctions.attr,
+    &dev_attr_politique.attr,
+    &dev_attr_etat.attr,
+    &dev_attr_perdus.attr,
+    &dev_attr_niveau_max.attr,
+    &dev_attr_suspensions.attr,
+    &dev_attr_blocages.attr,
+    NULL,
+};
+
+static struct attribute *compteurs_attrs[] = {
+    &dev_attr_compteur_balayages.attr,
+    &dev_attr_compteur_irq.attr,
+    &dev_attr_compteur_irq_parasites.attr,
+    &dev_attr_compteur_rebonds.attr,
+    &dev_attr_compteur_enfiles.attr,
+    &dev_attr_compteur_lus.attr,
+    &dev_attr_compteur_lectures_vides.attr,
+    &dev_attr_compteur_tempetes.attr,
+    &dev_attr_repli_ms.attr,
+    NULL,
+};
+
+static const struct attribute_group setrClavier_group = {
+    .attrs = setrClavier_attrs,
+};
+
+static const struct attribute_group compteurs_group = {
+    .name = "compteurs",            // Sous-répertoire /sys/class/setr/setrclavierN/compteurs/
+    .attrs = compteurs_attrs,
+};
+
+static const struct attribute_group *setrClavier_groups[] = {
+    &setrClavier_group,
+    &compteurs_group,
+    NULL,
+};
+
+
+static int setrclavier_probe(struct platform_device *pdev){
+    // Appelée lorsqu'un clavier (périphérique de plateforme "setrclavier" ou nœud "setr,clavier"
+    // du device tree) est lié au pilote : on lui crée son contexte, son fichier /dev/setrclavierN
+    // et ses GPIO, puis on démarre son balayage.
+    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
+    // un warning si une variable est déclarée après toute ligne de code)
+    struct setrClavier *clavier;
+    int ok, classe, ligne;
+
+    // Le contexte et ses compteurs sont libérés automatiquement lorsque le clavier est
+    // détaché du pilote
+    clavier = devm_kzalloc(&pdev->dev, sizeof(*clavier), GFP_KERNEL);
+    if (!clavier)
+        return -ENOMEM;
+    clavier->compteurs = devm_alloc_percpu(&pdev->dev, struct compteursClavier);
+    if (!clavier->compteurs)
+        return -ENOMEM;
+    clavier->parent = &pdev->dev;
+    clavier->politique = politiqueInitiale;
+    INIT_LIST_HEAD(&clavier->lecteurs);
+    spin_lock_init(&clavier->verrouLecteurs);
+    init_waitqueue_head(&clavier->fileAttente);
+    for(classe = 0; classe < NOMBRE_CLASSES_TOUCHES; classe++){
+        clavier->delaiRepetitionMs[classe] = delaiRepetitionMs;
+        clavier->periodeRepetitionMs[classe] = periodeRepetitionMs;
+    }
+    clavier->toucheRepetee = -1;
+    clavier->prochaineRepetition = KTIME_MAX;
+    for(ligne = 0; ligne < NOMBRE_MAX_LIGNES; ligne++)
+        clavier->delaisEtablissementNs[ligne] = delaiEtablissementUs * NSEC_PER_USEC;
+    mutex_init(&clavier->verrouUtilisateurs);
+    seqcount_init(&clavier->compteurInstantane);
+
+    // On alloue le tampon de diffusion et le journal
+    clavier->tampon = kvmalloc_array(tailleBuffer, sizeof(*clavier->tampon), GFP_KERNEL);
+    if (!clavier->tampon){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'allocation du buffer\n");
+        return -ENOMEM;
+    }
+    ok = creerJournal(clavier);
+    if (ok){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors de l'allocation du journal\n", ok);
+        goto erreurJournal;
+    }
+
+    // En cas d'erreur, chaque étape défait les précédentes, dans l'ordre inverse
+    // (voir les étiquettes à la fin de la fonction)
+
+    // On réserve l'index N du clavier, qui est aussi son numéro mineur
+    clavier->index = ida_alloc_max(&idaClaviers, NOMBRE_MAX_CLAVIERS - 1, GFP_KERNEL);
+    if (clavier->index < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : Pas plus de %d claviers!\n", NOMBRE_MAX_CLAVIERS);
+        ok = clavier->index;
+        goto erreurIndex;
+    }
+
+    // Initialisation des GPIO avec l'API "GPIO Descriptor Consumer Interface" : on obtient les
+    // deux groupes de GPIO du clavier (table de correspondances ou propriétés "ecriture-gpios" et
+    // "lecture-gpios" du device tree), avec la bonne direction. Avec les interruptions
+    // (modes irq et hybrid), les lignes sont initialement toutes à 1 pour qu'une
+    // pression déclenche une interruption.
+    clavier->gpioEcriture = gpiod_get_array(&pdev->dev, "ecriture",
+                                            modeBalayage == MODE_POLLING ? GPIOD_OUT_LOW : GPIOD_OUT_HIGH);
+    if (IS_ERR(clavier->gpioEcriture)){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'obtention des GPIO d'ecriture\n");
+        ok = PTR_ERR(clavier->gpioEcriture);
+        goto erreurGpioEcriture;
+    }
+    clavier->gpioLecture = gpiod_get_array(&pdev->dev, "lecture", GPIOD_IN);
+    if (IS_ERR(clavier->gpioLecture)){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'obtention des GPIO de lecture\n");
+        ok = PTR_ERR(clavier->gpioLecture);
+        goto erreurGpioLecture;
+    }
+
+    // La géométrie du clavier est celle de ses groupes de GPIO. Les masques de balayage et la
+    // disposition des touches sont calculés une seule fois, ici et à chaque modification de
+    // la disposition, pour que le balayage n'ait plus qu'à les appliquer.
+    if (clavier->gpioEcriture->ndescs > NOMBRE_MAX_LIGNES || clavier->gpioLecture->ndescs > NOMBRE_MAX_COLONNES){
+        printk(KERN_ALERT "SETR_CLAVIER : Le clavier doit avoir au plus %d GPIO d'ecriture et %d GPIO de lecture!\n",
+               NOMBRE_MAX_LIGNES, NOMBRE_MAX_COLONNES);
+        ok = -EINVAL;
+        goto erreurDisposition;
+    }
+    clavier->nombreLignes = clavier->gpioEcriture->ndescs;
+    clavier->nombreColonnes = clavier->gpioLecture->ndescs;
+    clavier->motifRepos = GENMASK(clavier->nombreLignes - 1, 0);
+    clavier->masqueColonnes = GENMASK(clavier->nombreColonnes - 1, 0);
+    clavier->gpio.ecrireLignes = ecrireLignesGpio;
+    clavier->gpio.lireColonnes = lireColonnesGpio;
+    clavier->gpio.attendre = attendreGpio;
+    clavier->gpio.contexte = clavier;
+    ok = changerDisposition(clavier, touches);
+    if (ok){
+        printk(KERN_ALERT "SETR_CLAVIER : Disposition des touches (%s) invalide pour un clavier %ux%u!\n",
+               touches, clavier->nombreLignes, clavier->nombreColonnes);
+        goto erreurDisposition;
+    }
+
+    // Le balayage n'a pas encore commencé : la calibration peut piloter les GPIO directement
+    if (calibrerAuChargement)
+        calibrerEtablissement(clavier);
+
+    // Création du fichier /dev/setrclavierN, avec ses attributs sysfs
+    cdev_init(&clavier->cdev, &fops);
+    clavier->cdev.owner = THIS_MODULE;
+    ok = cdev_add(&clavier->cdev, MKDEV(MAJOR(premierNumero), clavier->index), 1);
+    if (ok){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'appel a cdev_add!\n");
+        goto erreurCdev;
+    }
+    // Le clavier 0 garde le nom historique (/dev/setrclavier); les suivants sont numérotés
+    if (clavier->index == 0)
+        clavier->setrDevice = device_create_with_groups(setrClasse, &pdev->dev,
+                                                        MKDEV(MAJOR(premierNumero), clavier->index), clavier,
+                                                        setrClavier_groups, DEV_NAME);
+    else
+        clavier->setrDevice = device_create_with_groups(setrClasse, &pdev->dev,
+                                                        MKDEV(MAJOR(premierNumero), clavier->index), clavier,
+                                                        setrClavier_groups, DEV_NAME "%d", clavier->index);
+    if (IS_ERR(clavier->setrDevice)){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation du pilote de peripherique\n");
+        ok = PTR_ERR(clavier->setrDevice);
+        goto erreurDevice;
+    }
+
+    // Enregistrement optionnel auprès du sous-système input. Il doit être prêt
+    // avant que le balayage ne commence.
+    if (activerInput){
+        ok = creerClavierInput(clavier);
+        if (ok){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors de l'enregistrement du peripherique input\n", ok);
+            goto erreurInput;
+        }
+    }
+
+    // Les interruptions sont enregistrées masquées. Le balayage ne commence qu'avec le premier
+    // utilisateur (voir ajouterUtilisateur), éventuellement déjà là, ou dès maintenant avec
+    // balayerSansLecteur (par défaut).
+    if (modeBalayage != MODE_POLLING){
+        ok = demarrerIrq(clavier);
+        if (ok){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors de l'enregistrement des interruptions\n", ok);
+            goto erreurIrq;
+        }
+    }
+
+    creerDebugfs(clavier);
+    platform_set_drvdata(pdev, clavier);
+
+    mutex_lock(&clavier->verrouUtilisateurs);
+    clavier->balayagePret = true;
+    if (balayerSansLecteur || clavier->utilisateurs)
+        reprendreBalayage(clavier);
+    mutex_unlock(&clavier->verrouUtilisateurs);
+
+    printk(KERN_INFO "SETR_CLAVIER : Clavier %s pret!\n", dev_name(clavier->setrDevice));
+    return 0;
+
+erreurIrq:
+    if (clavier->clavierInput)
+        input_unregister_device(clavier->clavierInput);
+erreurInput:
+    device_destroy(setrClasse, MKDEV(MAJOR(premierNumero), clavier->index));
+erreurDevice:
+    cdev_del(&clavier->cdev);
+erreurCdev:
+    kfree(rcu_dereference_protected(clavier->disposition, true));
+erreurDisposition:
+    gpiod_put_array(clavier->gpioLecture);
+erreurGpioLecture:
+    gpiod_put_array(clavier->gpioEcriture);
+erreurGpioEcriture:
+    ida_free(&idaClaviers, clavier->index);
+erreurIndex:
+    vfree(clavier->journal);
+erreurJournal:
+    kvfree(clavier->tampon);
+    return ok;
+}
+
+static int setrclavier_remove(struct platform_device *pdev){
+    // Défait tout ce que setrclavier_probe a fait, dans l'ordre inverse. Le balayage est
+    // d'abord suspendu pour de bon : le thread de polling ne peut donc plus réactiver les
+    // interruptions une fois celles-ci relâchées.
+    struct setrClavier *clavier = platform_get_drvdata(pdev);
+
+    mutex_lock(&clavier->verrouUtilisateurs);
+    clavier->balayagePret = false;
+    if (clavier->balayageActif)
+        suspendreBalayage(clavier);
+    mutex_unlock(&clavier->verrouUtilisateurs);
+    if (modeBalayage != MODE_POLLING)
+        arreterIrq(clavier);
+    debugfs_remove_recursive(clavier->repertoireDebug);
+
+    // On retire le périphérique input, s'il a été créé
+    if (clavier->clavierInput)
+        input_unregister_device(clavier->clavierInput);
+
+    // On retire le fichier /dev/setrclavierN et on relâche les GPIO
+    device_destroy(setrClasse, MKDEV(MAJOR(premierNumero), clavier->index));
+    cdev_del(&clavier->cdev);
+    kfree(rcu_dereference_protected(clavier->disposition, true));
+    gpiod_put_array(clavier->gpioLecture);
+    gpiod_put_array(clavier->gpioEcriture);
+    ida_free(&idaClaviers, clavier->index);
+    vfree(clavier->journal);
+    kvfree(clavier->tampon);
+    return 0;
+}
+
+// Les claviers décrits par le device tree sont liés au pilote par cette propriété "compatible"
+static const struct of_device_id setrclavier_of_match[] = {
+    { .compatible = "setr,clavier" },
+    { },        // Toujours laisser une entrée vide à la fin!
+};
+MODULE_DEVICE_TABLE(of, setrclavier_of_match);
+
+static struct platform_driver setrPilote = {
+    .probe = setrclavier_probe,
+    .remove = setrclavier_remove,
+    .driver = {
+        .name = DEV_NAME,
+        .of_match_table = setrclavier_of_match,
+        // Un clavier n'est détaché qu'au retrait du module, qui attend que tous ses fichiers
+        // soient fermés (fops.owner) : son contexte n'est donc jamais libéré pendant une lecture
+        .suppress_bind_attrs = true,
+    },
+};
+
+
+static int __init setrclavier_init(void){
+    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
+    // un warning si une variable est déclarée après toute ligne de code)
+    int ok;
+
+    printk(KERN_INFO "SETR_CLAVIER : Initialisation du driver commencee\n");
+
+    ok = match_string(nomsModes, ARRAY_SIZE(nomsModes), mode);
+    if (ok < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : mode (%s) doit etre polling, irq ou hybrid!\n", mode);
+        return -EINVAL;
+    }
+    modeBalayage = ok;
+
+    ok = match_string(nomsPolitiques, ARRAY_SIZE(nomsPolitiques), politiqueDebordement);
+    if (ok < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : politiqueDebordement (%s) doit etre drop-newest, drop-oldest ou backpressure!\n", politiqueDebordement);
+        return -EINVAL;
+    }
+    politiqueInitiale = ok;
+
+    if (!is_power_of_2(tailleBuffer) || tailleBuffer < 2){
+        printk(KERN_ALERT "SETR_CLAVIER : tailleBuffer (%u) doit etre une puissance de 2 (au moins 2)!\n", tailleBuffer);
+        return -EINVAL;
+    }
+    if (!is_power_of_2(tailleJournal)){
+        printk(KERN_ALERT "SETR_CLAVIER : tailleJournal (%u) doit etre une puissance de 2!\n", tailleJournal);
+        return -EINVAL;
+    }
+
+    if (periodeRepetitionMs == 0){
+        printk(KERN_ALERT "SETR_CLAVIER : periodeRepetitionMs doit etre non nulle!\n");
+        return -EINVAL;
+    }
+
+    preparerMotifs();
+
+    // En cas d'erreur, chaque étape défait les précédentes, dans l'ordre inverse
+    // (voir les étiquettes à la fin de la fonction)
+
+    // On réserve les numéros (majeur, mineurs) de tous nos claviers
+    ok = alloc_chrdev_region(&premierNumero, 0, NOMBRE_MAX_CLAVIERS, DEV_NAME);
+    if (ok < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'appel a alloc_chrdev_region!\n");
+        return ok;
+    }
+
+    // Création de la classe de périphérique
+    setrClasse = class_create(THIS_MODULE, CLS_NAME);
+    if (IS_ERR(setrClasse)){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation de la classe de peripherique\n");
+        ok = PTR_ERR(setrClasse);
+        goto erreurClasse;
+    }
+
+    // Le thread de polling est commun à tous les claviers : il doit exister avant le premier
+    if (modeBalayage != MODE_IRQ){
+        ok = demarrerPolling();
+        if (ok){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors du lancement du thread de polling\n", ok);
+            goto erreurPolling;
+        }
+    }
+
+    // Enregistrement du pilote de plateforme : les claviers déjà décrits (device tree) y sont
+    // liés immédiatement (voir setrclavier_probe)
+    ok = platform_driver_register(&setrPilote);
+    if (ok){
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors de l'enregistrement du pilote de plateforme\n", ok);
+        goto erreurPilote;
+    }
+
+    // Création du clavier 0 : on enregistre sa table de correspondances (gpiosLignes et
+    // gpiosColonnes, sur le contrôleur puceGpio), puis le périphérique de plateforme lui-même
+    if (creerPeripherique){
+        ok = creerTableGpios();
+        if (ok){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors de la creation de la table des GPIO du clavier 0\n", ok);
+            goto erreurTable;
+        }
+        peripheriqueDefaut = platform_device_register_simple(DEV_NAME, 0, NULL, 0);
+        if (IS_ERR(peripheriqueDefaut)){
+            printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation du clavier 0\n");
+            ok = PTR_ERR(peripheriqueDefaut);
+            goto erreurPeripherique;
+        }
+    }
+
+    printk(KERN_INFO "SETR_CLAVIER : Fin de l'Initialisation (mode %s)!\n", nomsModes[modeBalayage]); // Made it! device was initialized
+
+    return 0;
+
+erreurPeripherique:
+    gpiod_remove_lookup_table(gpios_table);
+    kfree(gpios_table);
+erreurTable:
+    platform_driver_unregister(&setrPilote);
+erreurPilote:
+    if (modeBalayage != MODE_IRQ)
+        arreterPolling();
+erreurPolling:
+    class_destroy(setrClasse);
+erreurClasse:
+    unregister_chrdev_region(premierNumero, NOMBRE_MAX_CLAVIERS);
+    return ok;
+}
+
+
+static void __exit setrclavier_exit(void){
+    // On retire le clavier 0 puis le pilote, ce qui détache tous les claviers
+    // (voir setrclavier_remove), et enfin le thread de polling commun
+    if (peripheriqueDefaut){
+        platform_device_unregister(peripheriqueDefaut);
+        gpiod_remove_lookup_table(gpios_table);
+        kfree(gpios_table);
+    }
+    platform_driver_unregister(&setrPilote);
+    if (modeBalayage != MODE_IRQ)
+        arreterPolling();
+
+    // On retire correctement les différentes composantes du pilote
+    class_destroy(setrClasse);
+    unregister_chrdev_region(premierNumero, NOMBRE_MAX_CLAVIERS);
+    printk(KERN_INFO "SETR_CLAVIER : Terminaison du driver\n");
+}
+
+
+
+
+static int dev_open(struct inode *inodep, struct file *filep){
+    // Chaque fichier ouvert reçoit sa propre position dans le tampon de diffusion du clavier
+    // correspondant au numéro mineur ouvert (le cdev est inclus dans struct setrClavier).
+    // Il commence là où les lectures précédentes se sont arrêtées (positionLue) : les touches
+    // pressées alors qu'aucun fichier n'était lu lui sont retournées, dans la limite du tampon,
+    // comme avec un seul lecteur. Les événements déjà écrasés sont comptés dans ses sauts.
+    // Il commence en mode texte.
+    struct setrClavier *clavier = container_of(inodep->i_cdev, struct setrClavier, cdev);
+    struct lecteurClavier *lecteur;
+
+    printk(KERN_INFO "SETR_CLAVIER : Ouverture!\n");
+    lecteur = kzalloc(sizeof(*lecteur), GFP_KERNEL);
+    if(!lecteur)
+        return -ENOMEM;
+    mutex_init(&lecteur->verrou);
+    lecteur->clavier = clavier;
+    spin_lock(&clavier->verrouLecteurs);
+    lecteur->position = READ_ONCE(clavier->positionLue);
+    lecteur->sauts = sauterEcrases(tailleBuffer, smp_load_acquire(&clavier->teteTampon), &lecteur->position);
+    list_add(&lecteur->lien, &clavier->lecteurs);
+    spin_unlock(&clavier->verrouLecteurs);
+    filep->private_data = lecteur;
+    ajouterUtilisateur(clavier);
+    return 0;
+}
+static int dev_release(struct inode *inodep, struct file *filep){
+   struct lecteurClavier *lecteur = filep->private_data;
+   struct setrClavier *clavier = lecteur->clavier;
+
+   printk(KERN_INFO "SETR_CLAVIER : Fermeture!\n");
+   // On retire le fichier de la liste des processus à notifier par SIGIO
+   dev_fasync(-1, filep, 0);
+   spin_lock(&clavier->verrouLecteurs);
+   list_del(&lecteur->lien);
+   spin_unlock(&clavier->verrouLecteurs);
+   kfree(lecteur);
+   retirerUtilisateur(clavier);
+   return 0;
+}
+
+static bool produitCaractere(u8 type){
+    // En mode texte, seules les pressions et les répétitions produisent un caractère
+    return type == SETR_EVENEMENT_PRESSION || type == SETR_EVENEMENT_REPETITION;
+}
+
+static u32 evenementsEnAttente(struct lecteurClavier *lecteur){
+    // Nombre d'événements que ce fichier n'a pas encore lus (sans compter ceux déjà écrasés)
+    return min_t(u32, smp_load_acquire(&lecteur->clavier->teteTampon) - READ_ONCE(lecteur->position), tailleBuffer - 1);
+}
+
+static bool donneesDisponibles(struct lecteurClavier *lecteur){
+    // Vrai si read() a quelque chose à retourner. En mode texte, les relâchements et les
+    // accords bloqués ne produisent aucun caractère : on cherche donc une pression ou une répétition parmi
+    // les événements en attente. Appelée sans le mutex du lecteur (poll, attente) : une entrée écrasée
+    // pendant la recherche peut fausser le résultat, mais elle est de toute façon perdue
+    // pour ce lecteur, et le prochain balayage réveillera à nouveau la file d'attente.
+    struct setrClavier *clavier = lecteur->clavier;
+    u32 tete = smp_load_acquire(&clavier->teteTampon);
+    u32 position = READ_ONCE(lecteur->position);
+
+    if(tete - position > tailleBuffer - 1)
+        position = tete - (tailleBuffer - 1);
+    if(READ_ONCE(lecteur->binaire))
+        return position != tete;
+    for(; position != tete; position++)
+        if(produitCaractere(READ_ONCE(clavier->tampon[position & (tailleBuffer - 1)].evenement.type)))
+            return true;
+    return false;
+}
+
+static void avancerPositionLue(struct setrClavier *clavier, u32 position){
+    // positionLue ne fait qu'avancer, même si plusieurs fichiers lisent en même temps
+    // (chacun sous son propre mutex). Les positions sont des compteurs libres : on compare
+    // leur écart.
+    u32 actuelle = READ_ONCE(clavier->positionLue), vue;
+
+    while((s32)(position - actuelle) > 0){
+        vue = cmpxchg(&clavier->positionLue, actuelle, position);
+        if(vue == actuelle)
+            break;
+        actuelle = vue;
+    }
+}
+
+static ssize_t copierEnAttente(struct lecteurClavier *lecteur, char __user *destination, size_t place, bool binaire){
+    // Copie vers destination les événements que ce fichier n'a pas encore lus, et retourne
+    // le nombre d'unités copiées : des struct setr_evenement (place en est le nombre maximal)
+    // si binaire, sinon le caractère de chaque pression ou répétition (place est alors en octets).
+    // Ne bloque jamais; l'appelant doit détenir le mutex du lecteur.
+    //
+    // Le producteur n'attend jamais les lecteurs. Les événements sont donc d'abord copiés
+    // par lots dans un tableau local (lireLotTampon), qui écarte ceux qui ont pu être
+    // écrasés pendant la copie, avant de transmettre les autres à l'application.
+    struct setrClavier *clavier = lecteur->clavier;
+    struct setr_entree lot[LOT_LECTURE];
+    struct setr_evenement evenements[LOT_LECTURE];
+    char caracteres[LOT_LECTURE];
+    unsigned int n, i, ecrases, produits;
+    size_t copies = 0;
+    s64 maintenantNs = ktime_get_ns(), latencePremierNs = 0;
+
+    // Premier appel : ce fichier compte désormais dans la queue du tampon (voir calculerQueue)
+    if(!lecteur->actif){
+        WRITE_ONCE(lecteur->actif, true);
+        WRITE_ONCE(clavier->nouveauLecteur, true);
+    }
+
+    while(copies < place){
+        n = lireLotTampon(clavier->tampon, tailleBuffer, &clavier->teteTampon, &lecteur->position,
+                          &lecteur->sauts, lot, min_t(size_t, LOT_LECTURE, place - copies), &ecrases);
+        if(n == 0)
+            break;
+
+        // En mode texte, un événement produit au plus un caractère : le lot tient donc
+        // toujours dans la place restante, et tous ses événements sont consommés.
+        produits = 0;
+        for(i = ecrases; i < ecrases + n; i++){
+            if(!binaire && !produitCaractere(lot[i].evenement.type))
+                continue;
+            if(copies == 0 && produits == 0)
+                latencePremierNs = maintenantNs - lot[i].enfilageNs;
+            ajouterLatence(&clavier->histoEnfilageLecture, maintenantNs - lot[i].enfilageNs);
+            if(binaire)
+                evenements[produits] = lot[i].evenement;
+            else
+                caracteres[produits] = lot[i].evenement.caractere;
+            produits++;
+        }
+        if(binaire ? copy_to_user(destination + copies * sizeof(struct setr_evenement), evenements,
+                                  produits * sizeof(struct setr_evenement))
+                   : copy_to_user(destination + copies, caracteres, produits))
+            return copies ? copies : -EFAULT;
+        lecteur->position += n;
+        copies += produits;
+        this_cpu_add(clavier->compteurs->lus, produits);
+    }
+    avancerPositionLue(clavier, lecteur->position);
+    if(copies)
+        trace_setr_lecture(copies, latencePremierNs);
+    return copies;
+}
+
+static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset){
+    // Copie dans le buffer fourni ce que ce fichier n'a pas encore lu, jusqu'à concurrence
+    // de len : les caractères des touches pressées en mode texte (par défaut), ou des
+    // struct setr_evenement complètes en mode binaire (len doit alors en contenir au moins une).
+    // Chaque fichier ouvert a sa propre position : plusieurs processus reçoivent donc tous
+    // les événements, sans se les voler.
+    // Si rien n'est disponible, on s'endort sur fileAttente jusqu'à ce que le balayage
+    // ajoute quelque chose, sauf si le fichier est ouvert avec O_NONBLOCK (-EAGAIN)
+    // ou si lectureBloquante est désactivé (on retourne alors 0, comme avant).
+    // Le mutex du lecteur ne sérialise que les lectures faites sur le même fichier.
+    struct lecteurClavier *lecteur = filep->private_data;
+    ssize_t copies;
+    bool binaire;
+
+    if(len == 0)
+        return 0;
+
+    if(mutex_lock_interruptible(&lecteur->verrou))
+        return -ERESTARTSYS;
+    binaire = lecteur->binaire;
+    if(binaire && len < sizeof(struct setr_evenement)){
+        mutex_unlock(&lecteur->verrou);
+        return -EINVAL;
+    }
+
+    // En mode texte, les relâchements sont consommés sans rien produire : on se rendort
+    // si seuls des relâchements étaient en attente
+    while((copies = copierEnAttente(lecteur, buffer, binaire ? len / sizeof(struct setr_evenement) : len, binaire)) == 0){
+        mutex_unlock(&lecteur->verrou);
+        if(!lectureBloquante || (filep->f_flags & O_NONBLOCK))
+            this_cpu_inc(lecteur->clavier->compteurs->lecturesVides);
+        if(!lectureBloquante)
+            return 0;
+        if(filep->f_flags & O_NONBLOCK)
+            return -EAGAIN;
+        if(wait_event_interruptible(lecteur->clavier->fileAttente, donneesDisponibles(lecteur)))
+            return -ERESTARTSYS;
+        if(mutex_lock_interruptible(&lecteur->verrou))
+            return -ERESTARTSYS;
+    }
+    mutex_unlock(&lecteur->verrou);
+
+    if(copies > 0 && binaire)
+        copies *= sizeof(struct setr_evenement);
+    return copies;
+}
+
+static long viderEvenements(struct file *filep, struct setr_vidage __user *argument){
+    // SETR_IOCTL_VIDER : attend qu'au moins vidage.minimum événements soient disponibles
+    // (ou que le délai expire), puis copie jusqu'à vidage.capacite événements en un seul appel.
+    // Un minimum plus grand que le tampon ne pourrait jamais être atteint : il est donc
+    // ramené à tailleBuffer - 1.
+    struct lecteurClavier *lecteur = filep->private_data;
+    struct setr_vidage vidage;
+    long delai;
+    ssize_t copies;
+    u32 minimum;
+
+    if(copy_from_user(&vidage, argument, sizeof(vidage)))
+        return -EFAULT;
+    if(vidage.capacite == 0)
+        return -EINVAL;
+
+    minimum = min3(vidage.minimum, vidage.capacite, tailleBuffer - 1);
+    if(minimum && vidage.delaiMs != 0 && !(filep->f_flags & O_NONBLOCK)){
+        delai = vidage.delaiMs < 0 ? MAX_SCHEDULE_TIMEOUT : msecs_to_jiffies(vidage.delaiMs);
+        if(wait_event_interruptible_timeout(lecteur->clavier->fileAttente, evenementsEnAttente(lecteur) >= minimum, delai) < 0)
+            return -ERESTARTSYS;
+    }
+
+    if(mutex_lock_interruptible(&lecteur->verrou))
+        return -ERESTARTSYS;
+    copies = copierEnAttente(lecteur, u64_to_user_ptr(vidage.evenements), vidage.capacite, true);
+    mutex_unlock(&lecteur->verrou);
+    if(copies < 0)
+        return copies;
+    return put_user((__u32)copies, &argument->nombre);
+}
+
+static long dev_ioctl(struct file *filep, unsigned int commande, unsigned long argument){
+    // Voir setr_clavier.h pour la description des commandes
+    struct lecteurClavier *lecteur = filep->private_data;
+    struct setr_instantane instantane;
+    u32 sauts;
+
+    switch(commande){
+    case SETR_IOCTL_SAUTS:
+        // On tient aussi compte des événements écrasés depuis la dernière lecture
+        if(mutex_lock_interruptible(&lecteur->verrou))
+            return -ERESTARTSYS;
+        lecteur->sauts += sauterEcrases(tailleBuffer, smp_load_acquire(&lecteur->clavier->teteTampon),
+                                        &lecteur->position);
+        sauts = lecteur->sauts;
+        lecteur->sauts = 0;
+        mutex_unlock(&lecteur->verrou);
+        return put_user(sauts, (__u32 __user *)argument);
+    case SETR_IOCTL_MODE_LECTURE:
+        if(argument != SETR_LECTURE_TEXTE && argument != SETR_LECTURE_BINAIRE)
+            return -EINVAL;
+        if(mutex_lock_interruptible(&lecteur->verrou))
+            return -ERESTARTSYS;
+        WRITE_ONCE(lecteur->binaire, argument == SETR_LECTURE_BINAIRE);
+        mutex_unlock(&lecteur->verrou);
+        return 0;
+    case SETR_IOCTL_VIDER:
+        return viderEvenements(filep, (struct setr_vidage __user *)argument);
+    case SETR_IOCTL_INSTANTANE:
+        lireInstantane(lecteur->clavier, &instantane);
+        return copy_to_user((void __user *)argument, &instantane, sizeof(instantane)) ? -EFAULT : 0;
+    default:
+        return -ENOTTY;
+    }
+}
+
+static __poll_t dev_poll(struct file *filep, poll_table *wait){
+    // Le fichier est lisible dès que read() a quelque chose à retourner (voir donneesDisponibles).
+    // Si le fichier a été projeté avec mmap, on considère plutôt le journal partagé :
+    // l'application peut ainsi s'endormir jusqu'à ce qu'un événement soit disponible,
+    // sans jamais appeler read().
+    struct lecteurClavier *lecteur = filep->private_data;
+    struct setrClavier *clavier = lecteur->clavier;
+    __poll_t masque = 0;
+
+    poll_wait(filep, &clavier->fileAttente, wait);
+    if(READ_ONCE(lecteur->projete)){
+        if(smp_load_acquire(&clavier->journal->tete) != READ_ONCE(clavier->journal->queue))
+            masque |= EPOLLIN | EPOLLRDNORM;
+    }
+    else if(donneesDisponibles(lecteur))
+        masque |= EPOLLIN | EPOLLRDNORM;
+    return masque;
+}
+
+static int dev_mmap(struct file *filep, struct vm_area_struct *vma){
+    // Projette le journal d'événements (en-tête et entrées) dans l'espace utilisateur.
+    // La projection doit commencer au début du journal; remap_vmalloc_range refuse
+    // d'elle-même une taille supérieure à celle du journal.
+    struct lecteurClavier *lecteur = filep->private_data;
+    int ok;
+
+    if(vma->vm_pgoff != 0)
+        return -EINVAL;
+
+    ok = remap_vmalloc_range(vma, lecteur->clavier->journal, 0);
+    if(ok)
+        return ok;
+
+    WRITE_ONCE(lecteur->projete, true);
+    return 0;
+}
+
+static int dev_fasync(int fd, struct file *filep, int mode){
+    struct lecteurClavier *lecteur = filep->private_data;
+
+    return fasync_helper(fd, filep, mode, &lecteur->clavier->fileAsync);
+}
+
+// On enregistre les fonctions d'initialisation et de destruction
+module_init(setrclavier_init);
+module_exit(setrclavier_exit);
+
+// Description du module
+MODULE_LICENSE("GPL");            // Licence : laissez "GPL"
+MODULE_AUTHOR("Vous!");           // Vos noms
+MODULE_DESCRIPTION("Lecteur de clavier externe par polling, interruptions ou mode hybride");  // Description du module
+MODULE_VERSION("2.0");            // Numéro de version
@@ -1,343 +1,422 @@
 /******************************************************************************
 * H2025
 * LABORATOIRE 4, Systèmes embarqués et temps réel
-* Ébauche de code pour le pilote utilisant les interruptions
+* Balayage du clavier par interruptions (modes "irq" et "hybrid")
 * Marc-André Gardner, H2025
 *
-* Ce fichier contient la structure du pilote qu'il vous faut implémenter. Ce
-* pilote fonctionne avec des interruptions, c'est-à-dire qu'il vérifie la valeur
-* des touches appuyées que lorsqu'une touche est effectivement enfoncée.
+* Ce fichier contient la gestion des interruptions des colonnes. Le reste du
+* pilote (fichier, buffer, GPIO) se trouve dans setr_driver_core.c. Le clavier
+* n'est balayé que lorsqu'une touche est effectivement enfoncée. Tout l'état
+* est conservé dans le contexte de chaque clavier (struct setrClavier), passé
+* comme dev_id aux gestionnaires d'interruption.
+*
+* En mode "irq", le balayage est fait par un gestionnaire d'interruption "threadé"
+* (request_threaded_irq), et chaque touche passe par une machine à états
+* d'antirebond cadencée par un hrtimer :
+*   repos -> antirebond -> enfoncée -> relâchement -> repos
+*
+* Une fois l'antirebond terminé, les IRQ sont réarmées, même si une touche est tenue :
+* son relâchement produira un front sur sa colonne. La répétition automatique d'une
+* touche tenue est émise par le thread d'IRQ, qu'une seconde minuterie relance à
+* l'échéance de la prochaine répétition, comme le ferait une interruption.
+*
+* En mode "hybrid", l'interruption ne fait que réveiller le thread de polling
+* (voir setr_driver_polling.c), qui balaye tant qu'une touche est enfoncée.
+*
+* En mode "irq", une colonne recevant trop d'interruptions (fil flottant, mauvais
+* contact) est masquée, et le clavier est balayé périodiquement pendant dureeRepliMs
+* avant que ses interruptions ne soient réarmées (voir detecterTempete). Le mode
+* "hybrid" n'en a pas besoin : chaque interruption y est suivie d'au moins deux
+* périodes de balayage.
 *
 * Prenez le temps de lire attentivement les notes de cours et les commentaires
 * contenus dans ce fichier, ils contiennent des informations cruciales.
 *
 */
 
-// Inclusion des en-têtes nécessaires
-// Vous pouvez en ajouter, mais n'oubliez pas que vous n'avez PAS
-// accès la libc! Vous ne pouvez vous servir que des fonctions fournies
-// par le noyau Linux.
-#include <linux/init.h>             // Macros spécifiques des fonctions d'un module
 #include <linux/module.h>           // En-tête général des modules noyau
-#include <linux/device.h>           // Pour créer un pilote
 #include <linux/kernel.h>           // Différentes définitions de types liés au noyau
-#include <linux/gpio.h>             // Pour accéder aux GPIO du Raspberry Pi
-#include <linux/gpio/machine.h>     // Idem
-#include <linux/fs.h>               // Pour accéder au système de fichier et créer un fichier spécial dans /dev
-#include <linux/uaccess.h>          // Permet d'accéder à copy_to_user et copy_from_user
-#include <linux/delay.h>            // Fonctions d'attente, en particulier msleep
-#include <linux/string.h>           // Différentes fonctions de manipulation de string, plus memset et memcpy
 #include <linux/mutex.h>            // Mutex et synchronisation
-#include <linux/interrupt.h>        // Définit les symboles pour les interruptions et les tasklets
+#include <linux/interrupt.h>        // Définit les symboles pour les interruptions
+#include <linux/irq.h>              // irq_set_status_flags (IRQ_DISABLE_UNLAZY)
+#include <linux/hrtimer.h>          // Minuterie de l'antirebond
 #include <linux/atomic.h>           // Synchronisation par valeur atomique
+#include <linux/ktime.h>            // Horodatage des événements
+
+#include "setr_driver.h"            // Déclarations partagées avec le cœur du pilote
+#include "setr_clavier_trace.h"     // Points de traçage (définis dans setr_driver_core.c)
+
+// On déclare tout de suite le nom des fonctions gérant les interruptions
+static irqreturn_t  setr_irq_handler(int irq, void *dev_id);
+static irqreturn_t  setr_irq_thread(int irq, void *dev_id);
+
+// Durée pendant laquelle une touche doit rester stable pour qu'une pression ou
+// un relâchement soit accepté. Pendant ce temps, les IRQ des colonnes restent masquées :
+// les rebonds ne relancent donc pas de balayage. N'est pas utilisée en mode hybride.
+static unsigned int antirebondUs = 5000;
+module_param(antirebondUs, uint, S_IRUGO);
+MODULE_PARM_DESC(antirebondUs, " Duree de l'antirebond en mode irq (en us, 5000us par defaut)");
+
+// Protection contre les tempêtes d'interruptions, en mode irq seulement. Une colonne qui reçoit
+// plus de seuilTempeteIrq interruptions en FENETRE_TEMPETE_MS est masquée, et le clavier est
+// balayé toutes les antirebondUs pendant dureeRepliMs. Même en tapant très vite, une colonne
+// n'approche pas ce seuil : les IRQ restent masquées pendant l'antirebond, et les fronts
+// provoqués par le balayage ne sont pas rejoués (voir activerIrqColonnes). Une pression et
+// son relâchement coûtent donc une interruption chacun.
+#define FENETRE_TEMPETE_MS 100
+
+static unsigned int seuilTempeteIrq = 50;
+module_param(seuilTempeteIrq, uint, S_IRUGO);
+MODULE_PARM_DESC(seuilTempeteIrq, " Interruptions d'une colonne par 100ms au-dela desquelles elle est masquee (50 par defaut, 0 : jamais)");
+
+static unsigned int dureeRepliMs = 1000;
+module_param(dureeRepliMs, uint, S_IRUGO);
+MODULE_PARM_DESC(dureeRepliMs, " Duree du balayage periodique apres une tempete d'interruptions (en ms, 1000ms par defaut)");
+
+
+static bool appliquerAntirebond(struct setrClavier *clavier, unsigned int bit, bool brut, ktime_t maintenant, bool premier){
+    // Fait avancer l'antirebond d'une touche selon sa valeur lue (brut), avec une durée de
+    // antirebondUs (voir avancerAntirebond), et retourne vrai si un événement (pression ou
+    // relâchement) a été émis. L'événement est horodaté au premier contact.
+    int etat = avancerAntirebond(&clavier->antirebond, &clavier->dernierEtat, bit, brut,
+                                 ktime_to_ns(maintenant), (s64)antirebondUs * NSEC_PER_USEC);
+
+    if(etat == SETR_REBOND)
+        this_cpu_inc(clavier->compteurs->rebonds);
+    if(etat < 0)
+        return false;
+    ajouterEvenement(clavier, bit / BITS_PAR_LIGNE, bit % BITS_PAR_LIGNE, etat,
+                     ns_to_ktime(clavier->antirebond.debutNs[bit]), premier);
+    return true;
+}
 
-// Le nom de notre périphérique et le nom de sa classe
-#define DEV_NAME "setrclavier"
-#define CLS_NAME "setr"
-
-// Le nombre de caractères pouvant être contenus dans le buffer circulaire
-// Ce nombre est volontairement très bas pour vous permettre de tester votre logique
-// de buffer circulaire en cas de dépassement de la capacité du buffer
-#define TAILLE_BUFFER 10
-
-// Définit le nombre de lignes et de colonnes de votre clavier
-// TODO: adaptez-le selon le modèle de clavier que vous avez!
-#define NOMBRE_LIGNES 4
-#define NOMBRE_COLONNES 3
-
-
-// On déclare tout de suite le nom de la fonction gérant les interruptions
-static irqreturn_t  setr_irq_handler(unsigned int irq, void *dev_id);
-
-// Déclaration des fonctions pour gérer notre fichier
-// Nous ne définissons que open(), close() et read()
-static int     dev_open(struct inode *, struct file *);
-static int     dev_release(struct inode *, struct file *);
-static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
-
-static struct file_operations fops =
-{
-   .open = dev_open,
-   .read = dev_read,
-   .release = dev_release,
-};
-
-// Variables globales et statiques utilisées dans le driver
-static int    majorNumber;                  // Numéro donné par le noyau à notre pilote
-static char   data[TAILLE_BUFFER] = {0};    // Buffer circulaire contenant les caractères du clavier
-static size_t posCouranteLecture = 0;       // Position de la prochaine lecture dans le buffer
-static size_t posCouranteEcriture = 0;      // Position de la prochaine écriture dans le buffer
-
-static struct class*  setrClasse  = NULL;   // Contiendra les informations sur la classe de notre pilote
-static struct device* setrDevice = NULL;    // Contiendra les informations sur le périphérique associé
-
-static struct mutex sync;                   // Mutex servant à synchroniser les accès au buffer
-static atomic_t irqEnCours = ATOMIC_INIT(0);  // Pour déterminer si les interruptions doivent être traitées
-
-
-// 4 GPIO doivent être assignés pour l'écriture, et 3 ou 4 en lecture (voir énoncé)
-// Nous vous proposons les choix suivants, mais ce n'est pas obligatoire
-// Dans la table suivante, chaque ligne réfère à _un_ GPIO en particulier.
-// Le premier argument de chaque ligne ("pinctrl-bcm2835") ne doit pas être changé,
-//      il réfère au contrôleur enregistré sur le Raspberry Pi Zero W.
-// Le second argument est le numéro du _GPIO_ (PAS le Pin# du Raspberry Pi). Par
-//      exemple, la _pin_ 36 du Raspberry Pi Zero correspond au GPIO 16, c'est donc
-//      16 qu'il faut mettre ici. Voyez le schéma au début de l'énoncé pour plus de détails.
-// Le 3e argument est un identifiant que nous utiliserons pour enregistrer nos GPIO en groupe
-//      (tous les GPIO d'écriture ensemble et tous les GPIO de lecture ensemble) avec
-//      gpiod_get_array.
-// Le 4e argument est un index qui désigne spécifiquement chaque GPIO dans un groupe. Lorsque
-//      vous lirez ou écrirez dans un groupe, le "bitmap" demandé est un entier où chaque _bit_
-//      correspond à l'état d'un GPIO. Par exemple, avec la table telle que définie plus bas,
-//      le bit le moins significatif (LSB) du bitmap appliqué sur le groupe "écriture"
-//      écrira/lira le GPIO 5. Le second bit sera lié au GPIO 6, le 3e au GPIO 13, et ainsi de suite.
-// Le 5e argument est une suite de drapeaux paramétrant le GPIO. Ici, nous n'avons besoin que 
-//      de signifier que nous voulons que nos GPIO soient "active high", c'est-à-dire qu'écrire un
-//      "1" entraîne un voltage "haut" sur la pin. Vous pouvez trouver les autres drapeaux possibles
-//      ici : https://www.kernel.org/doc/html/v5.2/driver-api/gpio/board.html#platform-data
-static  struct gpiod_lookup_table gpios_table = {
-    .dev_id = DEV_NAME,
-    .table = {           /* Nom du contrôleur,GPIO, identifiant, index, actif haut ou bas */
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 5,  "ecriture", 0, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 6,  "ecriture", 1, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 13, "ecriture", 2, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 19, "ecriture", 3, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 12, "lecture",  0, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 16, "lecture",  1, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 20, "lecture",  2, GPIO_ACTIVE_HIGH),
-            #if NOMBRE_COLONNES == 4
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 21, "lecture", 3, GPIO_ACTIVE_HIGH),
-            #endif
-            { },        // Toujours laisser une entrée vide à la fin!
-    },
-};
-
-// Contiendra les descripteurs conservant la configuration des GPIO
-static struct gpio_descs *gpioLecture, *gpioEcriture;
-
-    
-// Les valeurs du clavier, selon la ligne et la colonne actives
-#if NOMBRE_COLONNES == 3
-    static char valeursClavier[NOMBRE_LIGNES][NOMBRE_COLONNES] = {
-        {'1', '2', '3'},
-        {'4', '5', '6'},
-        {'7', '8', '9'},
-        {'*', '0', '#'}
-    };
-#else
-    static char valeursClavier[NOMBRE_LIGNES][NOMBRE_COLONNES] = {
-        {'1', '2', '3', 'A'},
-        {'4', '5', '6', 'B'},
-        {'7', '8', '9', 'C'},
-        {'*', '0', '#', 'D'}
-    };
-#endif
-
-// Permet de se souvenir du dernier état du clavier,
-// pour ne pas répéter une touche qui était déjà enfoncée.
-static int dernierEtat[NOMBRE_LIGNES][NOMBRE_COLONNES] = {0};
-
-// Contient les numéros d'interruption pour chaque broche de lecture
-static unsigned int irqId[NOMBRE_COLONNES];               
-
-
-
-void func_tasklet_polling(unsigned long paramf){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-    
-    // Cette fonction est le coeur d'exécution du tasklet
-    // Elle fait à peu de choses près la même chose que le kthread
-    // dans le pilote que vous avez précédemment écrit (par polling),
-    // à savoir qu'elle balaye les différentes lignes pour trouver quelle
-    // touche est pressée.
-    // Une différence majeure est que ce tasklet ne s'exécute pas sans cesse,
-    // il ne s'exécute qu'une seule fois par interruption!
-    //
-    // Important: Vous DEVEZ utiliser l'API "GPIO Descriptor Consumer Interface"
-    // (ref : https://www.kernel.org/doc/html/v6.1/driver-api/gpio/consumer.html)
-    
-
-    // TODO
-    // Écrivez le code permettant
-    // 1) D'éviter le traitement de nouvelles interruptions : nous allons changer
-    //      les niveaux des broches de lecture, il ne faut pas que ce soit interprété
-    //      comme une nouvelle pression sur une touche, sinon ce tasklet sera rappelé
-    //      en boucle! Vous êtes libres d'utiliser l'approche que vous souhaitez pour
-    //      éviter cela, mais la variable atomique irqEnCours pourrait vous être utile...
-    // 2) De passer au travers de tous les patrons de balayage
-    // 3) Pour chaque patron, vérifier la valeur des lignes d'entrée
-    // 4) Selon ces valeurs et le contenu de dernierEtat, déterminer si une nouvelle touche a été pressée
-    // 5) Mettre à jour le buffer et dernierEtat en vous assurant d'éviter les race conditions avec le reste du module
-    // 6) Remettre toutes les lignes à 1 (pour réarmer l'interruption)
-    // 7) Réactiver le traitement des interruptions
-    //
-    // Information importante : vous n'en avez techniquement pas besoin de toute façon puisque
-    // cette fonction n'a pas à être exécutée en boucle, mais vous ne pouvez _pas_
-    // faire un msleep ou une autre fonction similaire dans un tasklet!
+static enum hrtimer_restart finAntirebond(struct hrtimer *minuterie){
+    // À la fin d'une période d'antirebond, on relance le thread d'IRQ pour qu'il
+    // relise la matrice. Les IRQ des colonnes sont toujours masquées à ce moment.
+    struct setrClavier *clavier = container_of(minuterie, struct setrClavier, minuterieAntirebond);
 
+    irq_wake_thread(clavier->irqId[0], clavier);
+    return HRTIMER_NORESTART;
 }
 
-// On déclare le tasklet avec la macro DECLARE_TASKLET_OLD
-DECLARE_TASKLET_OLD(tasklet_polling, func_tasklet_polling);
+void relancerBalayage(struct setrClavier *clavier){
+    // Demande un balayage immédiat, comme le ferait une interruption des colonnes : les IRQ
+    // sont d'abord masquées (voir setr_irq_handler), puis on réveille le thread qui balaye
+    // (thread d'IRQ en mode irq, thread de polling en mode hybride). Si elles le sont déjà,
+    // un balayage est en cours ou prévu. Appelable en contexte d'interruption.
+    int colonne;
+
+    if(!READ_ONCE(clavier->balayageActif) || atomic_cmpxchg(&clavier->irqEnCours, 0, 1) != 0)
+        return;
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+        disable_irq_nosync(clavier->irqId[colonne]);
+    if(modeBalayage == MODE_HYBRIDE)
+        reveillerPolling(clavier);
+    else
+        irq_wake_thread(clavier->irqId[0], clavier);
+}
 
+static enum hrtimer_restart finRepetition(struct hrtimer *minuterie){
+    // À l'échéance d'une répétition, on relance le balayage. S'il est déjà en cours ou
+    // prévu, celui-ci reprogrammera la minuterie.
+    relancerBalayage(container_of(minuterie, struct setrClavier, minuterieRepetition));
+    return HRTIMER_NORESTART;
+}
 
-static irqreturn_t  setr_irq_handler(unsigned int irq, void *dev_id){
-    // Ceci est la fonction recevant l'interruption. Son seul rôle consiste à
-    // céduler un tasklet qui fera le travail effectif de balayage.
-    // Attention toutefois : ce balayage ne doit pas faire en sorte que de _nouvelles_
-    // interruptions soient traitées et lancent encore le tasklet, sinon vous vous
-    // retrouverez dans une boucle sans fin où le tasklet crée des interruptions,
-    // qui lancent le tasklet, qui crée des interruptions, etc.
-    // Voyez les commentaires du tasklet pour une piste potentielle de synchronisation.
-    //
-    // N'oubliez pas que ce IRQ handler devrait en faire le _minimum_ et déférer le
-    // plus possible le traitement au tasklet!
-    // TODO
+static unsigned long colonnesEnfoncees(struct setrClavier *clavier){
+    // Colonnes qui doivent être actives, toutes les lignes à 1, d'après l'état des touches
+    unsigned long colonnes = 0;
+    unsigned int ligne;
 
-    // On retourne en indiquant qu'on a géré l'interruption
-    return (irqreturn_t) IRQ_HANDLED;
+    for(ligne = 0; ligne < clavier->nombreLignes; ligne++)
+        colonnes |= (unsigned long)(clavier->dernierEtat >> (ligne * BITS_PAR_LIGNE)) & clavier->masqueColonnes;
+    return colonnes;
 }
 
+void activerIrqColonnes(struct setrClavier *clavier){
+    // Réactive les IRQ des colonnes si setr_irq_handler les a masquées. Les lignes doivent
+    // déjà être toutes à 1 (voir poserMotifRepos) : une pression, ou le relâchement d'une
+    // touche tenue, déclenchera alors une interruption.
+    // Les IRQ sont masquées au contrôleur dès disable_irq_nosync (IRQ_DISABLE_UNLAZY, voir
+    // demarrerIrq) : les fronts provoqués par le balayage, qui fait basculer la colonne d'une
+    // touche tenue, ne sont donc pas retenus, puis rejoués ici. Une touche enfoncée ou relâchée
+    // pendant que les IRQ étaient masquées n'a pas non plus laissé de front; on compare donc
+    // les colonnes à l'état connu une fois les IRQ réactivées.
+    int colonne;
+
+    if(atomic_cmpxchg(&clavier->irqEnCours, 1, 0) == 1){
+        for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+            enable_irq(clavier->irqId[colonne]);
+        if(lireColonnes(clavier) != colonnesEnfoncees(clavier))
+            relancerBalayage(clavier);
+    }
+}
 
-static int __init setrclavier_init(void){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-    int ok;
-    printk(KERN_INFO "SETR_CLAVIER_IRQ : Initialisation du driver commencee\n");
+static void detecterTempete(struct setrClavier *clavier, int irq){
+    // Appelée par setr_irq_handler en mode irq, en contexte d'interruption dur. Compte les interruptions
+    // de la colonne par fenêtre de FENETRE_TEMPETE_MS; au-delà de seuilTempeteIrq, elle est
+    // masquée (en plus du masquage de toutes les colonnes par irqEnCours) jusqu'à la fin
+    // du repli (voir gererRepli). Le gestionnaire d'une IRQ ne s'exécute jamais en parallèle
+    // avec lui-même : les compteurs de chaque colonne n'ont donc pas besoin de verrou.
+    ktime_t maintenant;
+    int colonne;
+
+    if(seuilTempeteIrq == 0 || modeBalayage != MODE_IRQ)
+        return;
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++){
+        if(clavier->irqId[colonne] == irq)
+            break;
+    }
+    if(colonne == clavier->nombreColonnes)
+        return;
 
-    majorNumber = register_chrdev(0, DEV_NAME, &fops);
-    if (majorNumber<0){
-      printk(KERN_ALERT "SETR_CLAVIER_IRQ : Erreur lors de l'appel a register_chrdev!\n");
-      return majorNumber;
+    maintenant = ktime_get();
+    if(ktime_ms_delta(maintenant, clavier->debutFenetreIrq[colonne]) >= FENETRE_TEMPETE_MS){
+        clavier->debutFenetreIrq[colonne] = maintenant;
+        clavier->irqFenetre[colonne] = 0;
     }
+    if(++clavier->irqFenetre[colonne] <= seuilTempeteIrq)
+        return;
+
+    // La fin du repli doit être visible avant la colonne (test_and_set_bit est ordonné)
+    WRITE_ONCE(clavier->finRepli, ktime_add_ms(maintenant, dureeRepliMs));
+    if(test_and_set_bit(colonne, &clavier->colonnesTempete))
+        return;
+    disable_irq_nosync(irq);
+    this_cpu_inc(clavier->compteurs->tempetes);
+}
 
-    // Création de la classe de périphérique
-    setrClasse = class_create(THIS_MODULE, CLS_NAME);
-    if (IS_ERR(setrClasse)){
-      unregister_chrdev(majorNumber, DEV_NAME);
-      printk(KERN_ALERT "SETR_CLAVIER_IRQ : Erreur lors de la creation de la classe de peripherique\n");
-      return PTR_ERR(setrClasse);
+static bool gererRepli(struct setrClavier *clavier, ktime_t maintenant){
+    // Appelée au début de chaque balayage du thread d'IRQ.
+    // Retourne vrai tant que le clavier est en repli, c'est-à-dire qu'une colonne a été masquée
+    // par detecterTempete : le balayage ne doit alors pas réactiver les IRQ des colonnes, mais
+    // se relancer lui-même. À la fin du repli, les colonnes masquées sont réarmées, et le
+    // balayage reprend son fonctionnement normal.
+    unsigned long colonnes = READ_ONCE(clavier->colonnesTempete);
+    int colonne;
+
+    if(!colonnes)
+        return false;
+    if(!clavier->debutRepli){
+        WRITE_ONCE(clavier->debutRepli, maintenant);
+        printk(KERN_WARNING "SETR_CLAVIER : Tempete d'interruptions (colonnes 0x%lx) sur le clavier %d, balayage periodique pendant %u ms\n",
+               colonnes, clavier->index, dureeRepliMs);
+        return true;
     }
-    printk(KERN_INFO "SETR_CLAVIER_IRQ : device class OK\n");
-
-    // Création du pilote de périphérique associé
-    setrDevice = device_create(setrClasse, NULL, MKDEV(majorNumber, 0), NULL, DEV_NAME);
-    if (IS_ERR(setrDevice)){
-      class_destroy(setrClasse);
-      unregister_chrdev(majorNumber, DEV_NAME);
-      printk(KERN_ALERT "SETR_CLAVIER_IRQ : Erreur lors de la creation du pilote de peripherique\n");
-      return PTR_ERR(setrDevice);
+    if(ktime_before(maintenant, READ_ONCE(clavier->finRepli)))
+        return true;
+
+    WRITE_ONCE(clavier->repliNs, clavier->repliNs + ktime_to_ns(ktime_sub(maintenant, clavier->debutRepli)));
+    WRITE_ONCE(clavier->debutRepli, 0);
+    for_each_set_bit(colonne, &colonnes, clavier->nombreColonnes){
+        clear_bit(colonne, &clavier->colonnesTempete);
+        enable_irq(clavier->irqId[colonne]);
     }
+    return false;
+}
 
-
-   // TODO
-    // Initialisez les GPIO. Pour ce faire, vous DEVEZ utiliser l'API "GPIO Descriptor Consumer Interface"
-    // https://www.kernel.org/doc/html/v6.1/driver-api/gpio/consumer.html
-    //
-    // Plus précisément, dans l'initialisation, vous devrez:
-    // 1) Utiliser gpiod_add_lookup_table pour enregistrer la table de correspondances
-    //      définie dans gpios_table (plus haut)
-    // 2) Appeler 2 fois gpiod_get_array (une fois pour les GPIO en lecture, une fois pour ceux en écriture)
-    //      et mettre le résultat dans gpioLecture et gpioEcriture (déclarés plus haut). Validez que les
-    //      appels de fonction réussissent en utilisant la macro IS_ERR().
-    //      N'oubliez pas de leur donner la bonne direction!
+static irqreturn_t  setr_irq_thread(int irq, void *dev_id){
+    // Cette fonction s'exécute dans un thread noyau (gestionnaire "threadé"), après que
+    // setr_irq_handler a masqué les IRQ des colonnes. Elle balaye les différentes lignes,
+    // fait avancer l'antirebond de chaque touche, puis :
+    //  - si une touche est encore en transition, programme la minuterie d'antirebond
+    //      et laisse les IRQ masquées (les rebonds ne relancent donc pas de balayage);
+    //  - de même, tant que des touches fantômes possibles sont retenues (voir eliminerFantomes),
+    //      on balaye toutes les antirebondUs : le relâchement qui rendra la matrice lisible
+    //      ne produit pas toujours de front sur une colonne. C'est aussi le cas pendant
+    //      le repli qui suit une tempête d'interruptions (voir gererRepli);
+    //  - sinon, remet toutes les lignes à 1 et réactive les IRQ des colonnes, même si une
+    //      touche est tenue (son relâchement produira un front), puis programme la minuterie
+    //      de répétition si une touche est tenue.
     //
-    // Finalement, vous devez enregistrer une IRQ pour chaque GPIO en entrée. Utilisez
-    // pour ce faire gpiod_to_irq, ce qui vous donnera le numéro d'interruption lié à un
-    // GPIO en particulier, puis appelez request_irq comme présenté plus bas pour
-    // enregistrer la fonction de traitement de l'interruption.
-    // Attention, cette fonction devra être appelée 4 fois (une fois pour chaque GPIO)!
-    //
-    // Vous devez également initialiser le mutex de synchronisation.
-
-    ok = request_irq(irqno,                 // Le numéro de l'interruption, obtenue avec gpio_to_irq
-         (irq_handler_t) setr_irq_handler,  // Pointeur vers la routine de traitement de l'interruption
-         IRQF_TRIGGER_RISING,               // On veut une interruption sur le front montant (lorsque le bouton est pressé)
-         "setr_irq_handler",                // Le nom de notre interruption
-         NULL);                             // Paramètre supplémentaire inutile pour vous
-    if(ok != 0){
-        printk(KERN_ALERT "Erreur (%d) lors de l'enregistrement IRQ #{%d}!\n", ok, irqno);
-        device_destroy(setrClasse, MKDEV(majorNumber, 0));
-        class_destroy(setrClasse);
-        unregister_chrdev(majorNumber, DEV_NAME);
-        return ok;
+    // Seules les touches dont la valeur brute diffère de dernierEtat, ou qui sont déjà en
+    // transition, peuvent changer d'état : on ne parcourt que celles-là.
+    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
+    // un warning si une variable est déclarée après toute ligne de code)
+    struct setrClavier *clavier = dev_id;
+    unsigned int bit;
+    bool changement, parIrq, repli;
+    u64 brut, candidats;
+    s64 prochaineEcheance;
+    ktime_t maintenant;
+
+    // Balayage suspendu (voir suspendreIrq) : les IRQ restent masquées jusqu'à la reprise
+    if(!READ_ONCE(clavier->balayageActif))
+        return IRQ_HANDLED;
+
+    mutex_lock(&clavier->verrouBalayage);
+
+    // Politique backpressure : tant que le tampon est presque plein, on ne balaye pas
+    // (voir tamponSature). Les IRQ restent masquées et la minuterie relance un essai
+    // une période d'antirebond plus tard.
+    if(tamponSature(clavier)){
+        hrtimer_start(&clavier->minuterieAntirebond, ktime_add_us(ktime_get(), antirebondUs), HRTIMER_MODE_ABS);
+        mutex_unlock(&clavier->verrouBalayage);
+        return IRQ_HANDLED;
     }
 
+    // Un balayage lancé par une interruption (et non par une minuterie) qui ne voit aucun
+    // changement indique une interruption parasite : bruit ou câblage défectueux
+    parIrq = clavier->instantIrq != 0;
+    maintenant = noterDebutBalayage(clavier);
+    repli = gererRepli(clavier, maintenant);
+    brut = lireMatrice(clavier);
+    if(parIrq && brut == clavier->dernierEtat)
+        this_cpu_inc(clavier->compteurs->irqParasites);
+    changement = eliminerFantomes(clavier, &brut, maintenant, true);
+    candidats = (brut ^ clavier->dernierEtat) | clavier->antirebond.masqueTransition;
+    while(candidats){
+        bit = __ffs64(candidats);
+        candidats &= candidats - 1;
+        if(appliquerAntirebond(clavier, bit, (brut >> bit) & 1, maintenant, !changement))
+            changement = true;
+    }
+    if(emettreRepetition(clavier, maintenant, !changement))
+        changement = true;
+    if(changement)
+        publierEvenements(clavier);
+    publierInstantane(clavier, maintenant);
+
+    // Échéance d'antirebond la plus proche parmi les touches encore en transition
+    prochaineEcheance = prochaineEcheanceAntirebond(&clavier->antirebond, (s64)antirebondUs * NSEC_PER_USEC);
+    if(clavier->masqueAmbigu || repli)
+        prochaineEcheance = min_t(s64, prochaineEcheance, ktime_to_ns(ktime_add_us(maintenant, antirebondUs)));
+
+    // On remet toutes les lignes à 1 pour réarmer l'interruption
+    poserMotifRepos(clavier);
+
+    if(prochaineEcheance != S64_MAX){
+        hrtimer_start(&clavier->minuterieAntirebond, ns_to_ktime(prochaineEcheance), HRTIMER_MODE_ABS);
+    }
+    else{
+        activerIrqColonnes(clavier);
+        if(clavier->prochaineRepetition != KTIME_MAX)
+            hrtimer_start(&clavier->minuterieRepetition, clavier->prochaineRepetition, HRTIMER_MODE_ABS);
+    }
+    mutex_unlock(&clavier->verrouBalayage);
 
-    printk(KERN_INFO "SETR_CLAVIER_IRQ : Fin de l'Initialisation!\n"); // Made it! device was initialized
+    return IRQ_HANDLED;
+}
 
-    return 0;
+
+static irqreturn_t  setr_irq_handler(int irq, void *dev_id){
+    // Ceci est la fonction recevant l'interruption, en contexte d'interruption "dur".
+    // Elle en fait le _minimum_ : masquer les IRQ de toutes les colonnes (le balayage
+    // va changer les niveaux des broches de lecture, il ne faut pas que ce soit interprété
+    // comme une nouvelle pression) et réveiller le thread qui fera le balayage : le thread
+    // d'IRQ en mode irq, ou le thread de polling en mode hybride.
+    // irqEnCours garantit qu'on ne masque qu'une seule fois, pour que chaque
+    // disable_irq_nosync ait exactement un enable_irq correspondant.
+    struct setrClavier *clavier = dev_id;
+    int colonne;
+
+    trace_setr_irq(irq);
+    this_cpu_inc(clavier->compteurs->irq);
+    detecterTempete(clavier, irq);
+    if(atomic_cmpxchg(&clavier->irqEnCours, 0, 1) != 0)
+        return IRQ_HANDLED;
+
+    // Sert à mesurer le délai entre l'interruption et le début du balayage
+    clavier->instantIrq = ktime_get();
+
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+        disable_irq_nosync(clavier->irqId[colonne]);
+
+    if(modeBalayage == MODE_HYBRIDE){
+        reveillerPolling(clavier);
+        return IRQ_HANDLED;
+    }
+    return IRQ_WAKE_THREAD;
 }
 
 
-static void __exit setrclavier_exit(void){
-    // TODO
+int demarrerIrq(struct setrClavier *clavier){
+    // Enregistre une IRQ pour chaque GPIO en entrée du clavier. Elles restent masquées
+    // (IRQF_NO_AUTOEN) jusqu'à ce que le balayage commence (voir reprendreIrq).
     // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
     // un warning si une variable est déclarée après toute ligne de code)
+    int ok, colonne, irqno;
+
+    mutex_init(&clavier->verrouBalayage);
+    atomic_set(&clavier->irqEnCours, 0);
+
+    // Minuteries d'antirebond et de répétition, qui relancent le balayage à leur échéance
+    hrtimer_init(&clavier->minuterieAntirebond, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    clavier->minuterieAntirebond.function = finAntirebond;
+    hrtimer_init(&clavier->minuterieRepetition, CLOCK_MONOTONIC, HRTIMER_MODE_ABS);
+    clavier->minuterieRepetition.function = finRepetition;
+
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++){
+        irqno = gpiod_to_irq(clavier->gpioLecture->desc[colonne]);
+        ok = irqno < 0 ? irqno :
+             request_threaded_irq(irqno,        // Le numéro de l'interruption, obtenue avec gpiod_to_irq
+             setr_irq_handler,                  // Routine exécutée en contexte d'interruption (masquage)
+             setr_irq_thread,                   // Routine exécutée dans un thread (balayage et antirebond)
+             IRQF_TRIGGER_RISING | IRQF_TRIGGER_FALLING | // Front montant (pression) et descendant (relâchement)
+             IRQF_NO_AUTOEN,                    // Masquée jusqu'à reprendreIrq
+             "setr_irq_handler",                // Le nom de notre interruption
+             clavier);                          // Passé aux gestionnaires (dev_id)
+        if(ok != 0){
+            printk(KERN_ALERT "SETR_CLAVIER_IRQ : Erreur (%d) lors de l'enregistrement IRQ #{%d}!\n", ok, irqno);
+            goto erreurIrq;
+        }
+        clavier->irqId[colonne] = irqno;
+        // Masquer au contrôleur plutôt qu'au premier front suivant (voir activerIrqColonnes)
+        irq_set_status_flags(irqno, IRQ_DISABLE_UNLAZY);
+    }
+    return 0;
 
-    // TODO
-    // Écrivez le code permettant de relâcher (libérer) les GPIO
-    // 1) Relâchez les interruptions qui ont été précédemment enregistrées. 
-    //      Utilisez free_irq(irqno, NULL) pour chaque GPIO
-    // 2) Libérez les GPIO obtenus dans l'initialisation
-    // 3) Retirez la table de correspondances avec gpiod_remove_lookup_table
-
-
-    // On retire correctement les différentes composantes du pilote
-    device_destroy(setrClasse, MKDEV(majorNumber, 0));
-    class_destroy(setrClasse);
-    unregister_chrdev(majorNumber, DEV_NAME);
-    printk(KERN_INFO "SETR_CLAVIER_IRQ : Terminaison du driver\n");
+erreurIrq:
+    while(--colonne >= 0){
+        irq_clear_status_flags(clavier->irqId[colonne], IRQ_DISABLE_UNLAZY);
+        free_irq(clavier->irqId[colonne], clavier);
+    }
+    hrtimer_cancel(&clavier->minuterieAntirebond);
+    hrtimer_cancel(&clavier->minuterieRepetition);
+    return ok;
 }
 
+void arreterIrq(struct setrClavier *clavier){
+    // On relâche les interruptions (free_irq attend la fin des threads d'IRQ),
+    // puis on s'assure que les minuteries ne s'exécutent plus
+    int colonne;
 
-
-
-static int dev_open(struct inode *inodep, struct file *filep){
-    printk(KERN_INFO "SETR_CLAVIER_IRQ : Ouverture!\n");
-    // Rien à faire ici, si ce n'est retourner une valeur de succès
-    return 0;
-}
-static int dev_release(struct inode *inodep, struct file *filep){
-   printk(KERN_INFO "SETR_CLAVIER_IRQ : Fermeture!\n");
-   // Rien à faire ici, si ce n'est retourner une valeur de succès
-   return 0;
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++){
+        irq_clear_status_flags(clavier->irqId[colonne], IRQ_DISABLE_UNLAZY);
+        free_irq(clavier->irqId[colonne], clavier);
+    }
+    hrtimer_cancel(&clavier->minuterieAntirebond);
+    hrtimer_cancel(&clavier->minuterieRepetition);
 }
 
-static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-
-    // TODO
-    // Implémentez cette fonction de lecture
-    //
-    // Notez que si le reste de votre code est cohérent, elle peut être _exactement_
-    // la même que pour le driver par polling. Le reste des explications est simplement
-    // un copier coller des explications de l'autre driver.
-
-    // Celle-ci doit copier N caractères dans le buffer fourni en paramètre, N étant le minimum
-    // entre le nombre d'octets disponibles dans le buffer et le nombre d'octets demandés (paramètre len).
-    // Cette fonction DOIT se synchroniser au reste du module avec le mutex.
-    // N'oubliez pas d'utiliser copy_to_user et NON memcpy pour copier les données dans le buffer
-    // de l'utilisateur!
-    // Finalement, rappelez-vous que nous utilisons un buffer circulaire, c'est à dire que les nouvelles
-    // écritures se font sur des adresses croissantes, jusqu'à ce qu'on arrive à la fin du buffer et qu'on
-    // revienne alors à 0. Il est donc tout à fait possible que posCouranteEcriture soit INFÉRIEUR à
-    // posCouranteLecture, et vous devez gérer ce cas sans perdre de caractères et en respectant les
-    // autres conditions (par exemple, ne jamais copier plus que len caractères).
+void suspendreIrq(struct setrClavier *clavier){
+    // Masque les IRQ des colonnes jusqu'à reprendreIrq. balayageActif est déjà faux :
+    // relancerBalayage ne fait plus rien et setr_irq_thread s'arrête sans balayer.
+    // disable_irq attend la fin des gestionnaires en cours; une fois les minuteries annulées,
+    // on attend aussi un thread d'IRQ qu'elles auraient réveillé entre-temps.
+    int colonne;
+
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+        disable_irq(clavier->irqId[colonne]);
+    hrtimer_cancel(&clavier->minuterieAntirebond);
+    hrtimer_cancel(&clavier->minuterieRepetition);
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+        synchronize_irq(clavier->irqId[colonne]);
 }
 
+void reprendreIrq(struct setrClavier *clavier){
+    // Défait suspendreIrq (ou IRQF_NO_AUTOEN) et lance un balayage, comme relancerBalayage :
+    // les IRQ passent d'abord sous le contrôle de irqEnCours, pour qu'aucune interruption
+    // ne survienne avant ce balayage. Celui-ci les réactivera. En mode hybride, c'est
+    // l'appelant qui confie ensuite le clavier au thread de polling.
+    int colonne;
 
-// On enregistre les fonctions d'initialisation et de destruction
-module_init(setrclavier_init);
-module_exit(setrclavier_exit);
-
-// Description du module
-MODULE_LICENSE("GPL");            // Licence : laissez "GPL"
-MODULE_AUTHOR("Vous!");           // Vos noms
-MODULE_DESCRIPTION("Lecteur de clavier externe, avec interruptions");  // Description du module
-MODULE_VERSION("2.0");            // Numéro de version
+    if(atomic_cmpxchg(&clavier->irqEnCours, 0, 1) == 0){
+        for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+            disable_irq_nosync(clavier->irqId[colonne]);
+    }
+    for(colonne = 0; colonne < clavier->nombreColonnes; colonne++)
+        enable_irq(clavier->irqId[colonne]);
+    if(modeBalayage == MODE_IRQ)
+        irq_wake_thread(clavier->irqId[0], clavier);
+}
@@ -1,296 +1,385 @@
 /******************************************************************************
 * H2025
 * LABORATOIRE 4, Systèmes embarqués et temps réel
-* Ébauche de code pour le pilote utilisant le polling
+* Balayage du clavier par polling (modes "polling" et "hybrid")
 * Marc-André Gardner, H2025
 *
-* Ce fichier contient la structure du pilote qu'il vous faut implémenter. Ce
-* pilote fonctionne en mode "polling", c'est-à-dire qu'il vérifie en permanance
-* si un événement (pression d'une touche) s'est produit, grâce à un thread noyau.
+* Ce fichier contient le thread noyau qui vérifie en permanance si un
+* événement (pression d'une touche) s'est produit. Le reste du pilote
+* (fichier, buffer, GPIO) se trouve dans setr_driver_core.c.
+*
+* Un seul thread balaye tous les claviers liés au pilote : chacun a sa propre
+* échéance, et le thread dort jusqu'à la plus proche d'entre elles. Sa politique
+* d'ordonnancement et son processeur sont choisis au chargement (voir
+* configurerOrdonnancement), et l'écart entre chaque échéance et le début réel
+* du balayage est mesuré (histogramme gigue_balayage dans debugfs).
+*
+* En mode hybride, le thread ne balaye un clavier que tant qu'une de ses touches
+* est enfoncée : lorsque sa matrice est libre, il remet toutes ses lignes à 1,
+* réactive les interruptions de ses colonnes et l'ignore jusqu'à ce que l'une
+* d'elles le réveille.
 *
 * Prenez le temps de lire attentivement les notes de cours et les commentaires
 * contenus dans ce fichier, ils contiennent des informations cruciales.
 *
 */
 
-// Inclusion des en-têtes nécessaires
-// Vous pouvez en ajouter, mais n'oubliez pas que vous n'avez PAS
-// accès la libc! Vous ne pouvez vous servir que des fonctions fournies
-// par le noyau Linux.
-#include <linux/init.h>             // Macros spécifiques des fonctions d'un module
 #include <linux/module.h>           // En-tête général des modules noyau
-#include <linux/device.h>           // Pour créer un pilote
 #include <linux/kernel.h>           // Différentes définitions de types liés au noyau
-#include <linux/gpio.h>             // Pour accéder aux GPIO du Raspberry Pi
-#include <linux/gpio/machine.h>     // Idem
-#include <linux/fs.h>               // Pour accéder au système de fichier et créer un fichier spécial dans /dev
-#include <linux/uaccess.h>          // Permet d'accéder à copy_to_user et copy_from_user
 #include <linux/kthread.h>          // Utilisation des threads noyau
-#include <linux/delay.h>            // Fonctions d'attente, en particulier msleep
-#include <linux/string.h>           // Différentes fonctions de manipulation de string, plus memset et memcpy
-#include <linux/mutex.h>            // Mutex et synchronisation
-#include <linux/interrupt.h>        // Définit les symboles pour les interruptions et les tasklets
-#include <linux/atomic.h>           // Synchronisation par valeur atomique
-
-
-// Le nom de notre périphérique et le nom de sa classe
-#define DEV_NAME "setrclavier"
-#define CLS_NAME "setr"
-
-// Le nombre de caractères pouvant être contenus dans le buffer circulaire
-// Ce nombre est volontairement très bas pour vous permettre de tester votre logique
-// de buffer circulaire en cas de dépassement de la capacité du buffer
-#define TAILLE_BUFFER 10
-
-// Définit le nombre de lignes et de colonnes de votre clavier
-// TODO: adaptez-le selon le modèle de clavier que vous avez!
-#define NOMBRE_LIGNES 4
-#define NOMBRE_COLONNES 3
-
-
-// Déclaration des fonctions pour gérer notre fichier
-// Nous ne définissons que open(), close() et read()
-static int     dev_open(struct inode *, struct file *);
-static int     dev_release(struct inode *, struct file *);
-static ssize_t dev_read(struct file *, char *, size_t, loff_t *);
-
-static struct file_operations fops =
-{
-   .open = dev_open,
-   .read = dev_read,
-   .release = dev_release,
-};
-
-// Variables globales et statiques utilisées dans le driver
-static int    majorNumber;                 // Numéro donné par le noyau à notre pilote
-static char   data[TAILLE_BUFFER] = {0};   // Buffer circulaire contenant les caractères du clavier
-static size_t posCouranteLecture = 0;      // Position de la prochaine lecture dans le buffer
-static size_t posCouranteEcriture = 0;     // Position de la prochaine écriture dans le buffer
-
-static struct class*  setrClasse  = NULL;  // Contiendra les informations sur la classe de notre pilote
-static struct device* setrDevice = NULL;   // Contiendra les informations sur le périphérique associé
-
-static struct mutex sync;                  // Mutex servant à synchroniser les accès au buffer
-static struct task_struct *task;           // Réfère au thread noyau qui sera lancé
-
-
-// 4 GPIO doivent être assignés pour l'écriture, et 3 ou 4 en lecture (voir énoncé)
-// Nous vous proposons les choix suivants, mais ce n'est pas obligatoire
-// Dans la table suivante, chaque ligne réfère à _un_ GPIO en particulier.
-// Le premier argument de chaque ligne ("pinctrl-bcm2835") ne doit pas être changé,
-//      il réfère au contrôleur enregistré sur le Raspberry Pi Zero W.
-// Le second argument est le numéro du _GPIO_ (PAS le Pin# du Raspberry Pi). Par
-//      exemple, la _pin_ 36 du Raspberry Pi Zero correspond au GPIO 16, c'est donc
-//      16 qu'il faut mettre ici. Voyez le schéma au début de l'énoncé pour plus de détails.
-// Le 3e argument est un identifiant que nous utiliserons pour enregistrer nos GPIO en groupe
-//      (tous les GPIO d'écriture ensemble et tous les GPIO de lecture ensemble) avec
-//      gpiod_get_array.
-// Le 4e argument est un index qui désigne spécifiquement chaque GPIO dans un groupe. Lorsque
-//      vous lirez ou écrirez dans un groupe, le "bitmap" demandé est un entier où chaque _bit_
-//      correspond à l'état d'un GPIO. Par exemple, avec la table telle que définie plus bas,
-//      le bit le moins significatif (LSB) du bitmap appliqué sur le groupe "écriture"
-//      écrira/lira le GPIO 5. Le second bit sera lié au GPIO 6, le 3e au GPIO 13, et ainsi de suite.
-// Le 5e argument est une suite de drapeaux paramétrant le GPIO. Ici, nous n'avons besoin que 
-//      de signifier que nous voulons que nos GPIO soient "active high", c'est-à-dire qu'écrire un
-//      "1" entraîne un voltage "haut" sur la pin. Vous pouvez trouver les autres drapeaux possibles
-//      ici : https://www.kernel.org/doc/html/v5.2/driver-api/gpio/board.html#platform-data
-static  struct gpiod_lookup_table gpios_table = {
-    .dev_id = DEV_NAME,
-    .table = {           /* Nom du contrôleur,GPIO, identifiant, index, actif haut ou bas */
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 5,  "ecriture", 0, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 6,  "ecriture", 1, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 13, "ecriture", 2, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 19, "ecriture", 3, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 12, "lecture",  0, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 16, "lecture",  1, GPIO_ACTIVE_HIGH),
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 20, "lecture",  2, GPIO_ACTIVE_HIGH),
-            #if NOMBRE_COLONNES == 4
-            GPIO_LOOKUP_IDX("pinctrl-bcm2835", 21, "lecture", 3, GPIO_ACTIVE_HIGH),
-            #endif
-            { },        // Toujours laisser une entrée vide à la fin!
-    },
-};
-
-// Contiendra les descripteurs conservant la configuration des GPIO
-static struct gpio_descs *gpioLecture, *gpioEcriture;
-
-    
-// Les valeurs du clavier, selon la ligne et la colonne actives
-#if NOMBRE_COLONNES == 3
-    static char valeursClavier[NOMBRE_LIGNES][NOMBRE_COLONNES] = {
-        {'1', '2', '3'},
-        {'4', '5', '6'},
-        {'7', '8', '9'},
-        {'*', '0', '#'}
-    };
-#else
-    static char valeursClavier[NOMBRE_LIGNES][NOMBRE_COLONNES] = {
-        {'1', '2', '3', 'A'},
-        {'4', '5', '6', 'B'},
-        {'7', '8', '9', 'C'},
-        {'*', '0', '#', 'D'}
-    };
-#endif
-
-// Permet de se souvenir du dernier état du clavier,
-// pour ne pas répéter une touche qui était déjà enfoncée.
-static int dernierEtat[NOMBRE_LIGNES][NOMBRE_COLONNES] = {0};
+#include <linux/sched.h>            // wake_up_process, schedule
+#include <linux/sched/types.h>      // struct sched_attr (SCHED_FIFO, SCHED_DEADLINE)
+#include <linux/cpumask.h>          // cpu_online
+#include <linux/string.h>           // match_string
+#include <linux/hrtimer.h>          // Pauses à haute résolution du thread de polling
+#include <linux/mutex.h>            // Protection de la liste des claviers
+#include <linux/ktime.h>            // Horodatage des événements
+
+#include "setr_driver.h"            // Déclarations partagées avec le cœur du pilote
+
+static struct task_struct *task;    // Réfère au thread noyau qui sera lancé
+static LIST_HEAD(listeClaviers);    // Claviers balayés par le thread (voir ajouterPolling)
+static DEFINE_MUTEX(verrouClaviers); // Protège listeClaviers; détenu pendant les balayages
+static bool reveilDemande = false;  // Un clavier a été ajouté, ou une interruption demande un balayage
 
 
 // Vous devez déclarer cette variable comme paramètre
+// Pause entre deux balayages lorsque le clavier est au repos : c'est la période maximale
+// du balayage adaptatif ci-dessous, à moins que periodeMaxUs ne soit donnée.
 static unsigned int pausePollingMs = 20;
 module_param(pausePollingMs, uint, S_IRUGO);
-MODULE_PARM_DESC(pausePollingMs, " Duree de la pause apres chaque polling (en ms, 20ms par defaut)");
+MODULE_PARM_DESC(pausePollingMs, " Duree de la pause apres chaque polling, clavier au repos (en ms, 20ms par defaut)");
+
+// Période de balayage. Le thread n'utilise plus msleep (arrondi au jiffy, donc imprécis) mais
+// une échéance absolue sur un hrtimer. Tant qu'une touche est enfoncée, ou l'a été il y a moins
+// de delaiActiviteMs, on balaye à periodeMinUs. Ensuite, la période double à chaque balayage
+// sans activité, jusqu'à periodeMaxUs (pausePollingMs par défaut). Une pause plus courte que
+// periodeMinUs donne une période fixe, comme avec msleep. En mode hybride, seule periodeMinUs
+// est utilisée. Ces paramètres s'appliquent à chaque clavier séparément.
+static unsigned int periodeMinUs = 5000;
+module_param(periodeMinUs, uint, S_IRUGO);
+MODULE_PARM_DESC(periodeMinUs, " Periode de balayage lorsque le clavier est actif (en us, 5000us par defaut)");
+
+static unsigned int periodeMaxUs = 0;
+module_param(periodeMaxUs, uint, S_IRUGO);
+MODULE_PARM_DESC(periodeMaxUs, " Periode de balayage maximale lorsque le clavier est inactif (en us, 0 par defaut : pausePollingMs)");
+
+static unsigned int delaiActiviteMs = 500;
+module_param(delaiActiviteMs, uint, S_IRUGO);
+MODULE_PARM_DESC(delaiActiviteMs, " Duree pendant laquelle on reste a la periode minimale apres une activite (en ms, 500ms par defaut)");
+
+// Ordonnancement du thread de polling. Par défaut, c'est un thread ordinaire (CFS), qu'une
+// charge élevée peut retarder. Avec "fifo", il passe devant toute tâche ordinaire et toute
+// tâche SCHED_FIFO de priorité plus faible (les threads d'IRQ de PREEMPT_RT sont à 50).
+// Avec "deadline", le noyau lui garantit runtimeDeadlineUs de CPU à chaque periodeDeadlineUs,
+// ce qui doit couvrir le balayage de tous les claviers à la période minimale.
+// cpuPolling réserve le thread à un processeur (-1 : n'importe lequel); le noyau refuse de
+// fixer le processeur d'une tâche SCHED_DEADLINE, les deux sont donc exclusifs.
+static const char * const nomsOrdonnancements[] = { "normal", "fifo", "deadline" };
+
+static char *ordonnancement = "normal";
+module_param(ordonnancement, charp, S_IRUGO);
+MODULE_PARM_DESC(ordonnancement, " Ordonnancement du thread de polling : normal, fifo ou deadline (normal par defaut)");
+
+static unsigned int prioriteFifo = 60;
+module_param(prioriteFifo, uint, S_IRUGO);
+MODULE_PARM_DESC(prioriteFifo, " Priorite SCHED_FIFO du thread de polling, de 1 a 99 (60 par defaut)");
+
+static unsigned int runtimeDeadlineUs = 500;
+module_param(runtimeDeadlineUs, uint, S_IRUGO);
+MODULE_PARM_DESC(runtimeDeadlineUs, " Temps CPU garanti par periode avec SCHED_DEADLINE (en us, 500us par defaut)");
+
+static unsigned int periodeDeadlineUs = 5000;
+module_param(periodeDeadlineUs, uint, S_IRUGO);
+MODULE_PARM_DESC(periodeDeadlineUs, " Periode SCHED_DEADLINE du thread de polling (en us, 5000us par defaut)");
+
+static int cpuPolling = -1;
+module_param(cpuPolling, int, S_IRUGO);
+MODULE_PARM_DESC(cpuPolling, " Processeur du thread de polling (-1 par defaut : n'importe lequel)");
+
+
+static void attendreInterruption(struct setrClavier *clavier){
+    // Mode hybride : la matrice de ce clavier est libre, on remet toutes ses lignes à 1 et on
+    // réactive les interruptions de ses colonnes. Le thread ne le balaye plus jusqu'à ce que
+    // setr_irq_handler le réveille (voir reveillerPolling).
+    //
+    // clavier->reveilDemande est remis à zéro *avant* de réactiver les interruptions : une
+    // interruption survenant ensuite est donc toujours vue au prochain tour de pollClavier.
+    WRITE_ONCE(clavier->reveilDemande, false);
+    clavier->enAttenteIrq = true;
+    poserMotifRepos(clavier);
+    activerIrqColonnes(clavier);
+}
 
+static void balayerClavier(struct setrClavier *clavier){
+    // Balaye un clavier dont l'échéance est atteinte, puis fixe sa prochaine échéance
+    struct setr_changement changements[NOMBRE_MAX_TOUCHES];
+    unsigned int nombre, i;
+    bool premier, parIrq;
+    u64 brut, matrice;
+    ktime_t horodatage;
+
+    // Politique backpressure : tant que le tampon est presque plein, on ne balaye pas
+    // (voir tamponSature) et on réessaie à la période minimale
+    if(tamponSature(clavier)){
+        clavier->periodeNs = (u64)periodeMinUs * NSEC_PER_USEC;
+        clavier->echeance = ktime_add_ns(ktime_get(), clavier->periodeNs);
+        return;
+    }
+
+    // 1) On lit l'état de toute la matrice (voir lireMatrice), où les touches fantômes
+    //      possibles gardent leur état précédent (voir eliminerFantomes)
+    // 2) On décode les touches ayant changé depuis dernierEtat (voir decoderMatrice)
+    // 3) Chacune est ajoutée au buffer (sans verrou, voir ajouterAuTampon)
+    // Les pressions et relâchements sont aussi ajoutés au journal partagé et transmis
+    // au sous-système input, horodatés au début du balayage.
+    // Mode hybride : voir interruptions parasites dans setr_irq_thread
+    parIrq = clavier->instantIrq != 0;
+    horodatage = noterDebutBalayage(clavier);
+    brut = matrice = lireMatrice(clavier);
+    if(parIrq && brut == clavier->dernierEtat)
+        this_cpu_inc(clavier->compteurs->irqParasites);
+    premier = !eliminerFantomes(clavier, &matrice, horodatage, true);
+    nombre = decoderMatrice(clavier->dernierEtat, matrice, changements);
+    for(i = 0; i < nombre; i++){
+        ajouterEvenement(clavier, changements[i].ligne, changements[i].colonne, changements[i].etat,
+                         horodatage, premier);
+        premier = false;
+    }
+    // 4) La touche tenue est répétée si son échéance est atteinte (voir emettreRepetition)
+    if(emettreRepetition(clavier, horodatage, premier))
+        premier = false;
+    if(!premier)
+        publierEvenements(clavier);
+
+    // Choix de la prochaine période : rapide si le clavier est (ou a récemment été) utilisé,
+    // sinon on double la période jusqu'au maximum pour limiter les réveils au repos.
+    // Une touche retenue par eliminerFantomes compte comme une activité.
+    if(matrice != clavier->dernierEtat || brut != 0){
+        clavier->derniereActivite = horodatage;
+        clavier->periodeNs = (u64)periodeMinUs * NSEC_PER_USEC;
+    }
+    else if(ktime_ms_delta(horodatage, clavier->derniereActivite) >= delaiActiviteMs){
+        clavier->periodeNs = min_t(u64, clavier->periodeNs * 2, (u64)periodeMaxUs * NSEC_PER_USEC);
+    }
+    clavier->dernierEtat = matrice;
+    publierInstantane(clavier, horodatage);
+
+    // Mode hybride : on retourne à l'attente d'une interruption lorsque la matrice est
+    // restée libre pendant deux balayages consécutifs. Le second balayage laisse passer
+    // les rebonds du relâchement, qui relanceraient sinon aussitôt une interruption.
+    // Chaque interruption coûte donc au moins deux périodes de balayage : une tempête
+    // d'interruptions ne peut pas réveiller le thread plus souvent qu'en mode polling, et
+    // n'a pas besoin de la protection du mode irq (voir detecterTempete).
+    if(modeBalayage == MODE_HYBRIDE){
+        clavier->balayagesLibres = brut ? 0 : clavier->balayagesLibres + 1;
+        if(clavier->balayagesLibres >= 2){
+            clavier->balayagesLibres = 0;
+            attendreInterruption(clavier);
+            return;
+        }
+    }
 
+    // L'échéance est absolue : la durée du balayage ne s'accumule pas dans la période.
+    // Si on est en retard (par exemple après une préemption), on repart de maintenant
+    // plutôt que d'enchaîner des balayages pour rattraper le temps perdu.
+    clavier->echeance = ktime_add_ns(clavier->echeance, clavier->periodeNs);
+    if(ktime_before(clavier->echeance, ktime_get()))
+        clavier->echeance = ktime_add_ns(ktime_get(), clavier->periodeNs);
+
+    // Le balayage suivant a lieu au plus tard à l'échéance de la prochaine répétition,
+    // pour qu'elle soit émise à l'heure plutôt qu'au prochain multiple de la période
+    if(ktime_before(clavier->prochaineRepetition, clavier->echeance))
+        clavier->echeance = clavier->prochaineRepetition;
+}
 
 static int pollClavier(void *arg){
-    // Cette fonction contient la boucle principale du thread détectant une pression sur une touche
-    
-    // TODO
+    // Cette fonction contient la boucle principale du thread détectant une pression sur une touche.
+    // À chaque tour, elle balaye les claviers dont l'échéance est atteinte, puis s'endort
+    // jusqu'à la plus proche des échéances restantes (indéfiniment si aucun clavier n'est
+    // à balayer, par exemple lorsqu'ils attendent tous une interruption en mode hybride).
+    //
+    // reveilDemande est remis à zéro *avant* de parcourir les claviers, et vérifié *après*
+    // être passé à TASK_INTERRUPTIBLE : un réveil survenant pendant le parcours n'est donc
+    // jamais perdu (soit on voit le drapeau, soit wake_up_process nous remet à TASK_RUNNING
+    // et le sommeil se termine immédiatement).
+
     // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
     // un warning si une variable est déclarée après toute ligne de code)
-    
-    
+    struct setrClavier *clavier;
+    ktime_t prochaineEcheance, maintenant;
+    u64 margeNs;
+    bool reveilIrq;
+
     printk(KERN_INFO "SETR_CLAVIER : Poll clavier declenche! \n");
     while(!kthread_should_stop()){           // Permet de s'arrêter en douceur lorsque kthread_stop() sera appelé
       set_current_state(TASK_RUNNING);      // On indique qu'on est en train de faire quelque chose
-
-      // TODO
-      // Écrivez le code permettant de lire la clavier. Vous DEVEZ utiliser l'API "GPIO Descriptor Consumer Interface"
-      // (ref : https://www.kernel.org/doc/html/v6.1/driver-api/gpio/consumer.html)
-      //
-      // En détail, vous devrez créer une boucle qui, pour chaque ligne d'écriture:
-      // 1) Active cette ligne et désactive les autres (en utilisant gpiod_set_array_value)
-      // 2) Lit la valeur des lignes d'entrée
-      // 3) Selon ces valeurs et le contenu de dernierEtat, détermine si une nouvelle touche a été pressée
-      // 4) Met à jour le buffer et dernierEtat en s'assurant d'éviter les race conditions avec le reste du module
-
-
+      WRITE_ONCE(reveilDemande, false);
+      smp_mb();
+
+      prochaineEcheance = KTIME_MAX;
+      margeNs = 0;
+      mutex_lock(&verrouClaviers);
+      list_for_each_entry(clavier, &listeClaviers, lienPolling){
+          reveilIrq = clavier->enAttenteIrq;
+          if(clavier->enAttenteIrq){
+              if(!READ_ONCE(clavier->reveilDemande))
+                  continue;
+              clavier->enAttenteIrq = false;
+              clavier->echeance = ktime_get();
+          }
+          // La gigue est le retard du balayage sur son échéance. Elle n'a pas de sens pour
+          // un balayage demandé par une interruption (mesuré par latence_irq_balayage).
+          maintenant = ktime_get();
+          if(!ktime_before(maintenant, clavier->echeance)){
+              if(!reveilIrq)
+                  ajouterLatence(&clavier->histoGigue, ktime_to_ns(ktime_sub(maintenant, clavier->echeance)));
+              balayerClavier(clavier);
+          }
+          if(!clavier->enAttenteIrq && ktime_before(clavier->echeance, prochaineEcheance)){
+              prochaineEcheance = clavier->echeance;
+              margeNs = clavier->periodeNs / 16;
+          }
+      }
+      mutex_unlock(&verrouClaviers);
+
+      // La marge (slack) permet au noyau de regrouper nos réveils avec d'autres timers;
+      // elle est proportionnelle à la période, donc plus grande au repos. Elle est ignorée
+      // par le noyau si le thread est temps réel (fifo ou deadline) : il est alors réveillé
+      // à l'échéance exacte, par un hrtimer expirant en contexte d'interruption dur.
       set_current_state(TASK_INTERRUPTIBLE); // On indique qu'on peut être interrompu
-      msleep(pausePollingMs);                // On se met en pause un certain temps
+      if(READ_ONCE(reveilDemande) || kthread_should_stop())
+          continue;
+      if(prochaineEcheance == KTIME_MAX)
+          schedule();
+      else
+          schedule_hrtimeout_range(&prochaineEcheance, margeNs, HRTIMER_MODE_ABS);
     }
+    __set_current_state(TASK_RUNNING);
     printk(KERN_INFO "SETR_CLAVIER : Poll clavier stop! \n");
     return 0;
 }
 
-
-static int __init setrclavier_init(void){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-    
-    printk(KERN_INFO "SETR_CLAVIER : Initialisation du driver commencee\n");
-
-    // On enregistre notre pilote
-    majorNumber = register_chrdev(0, DEV_NAME, &fops);
-    if (majorNumber<0){
-        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de l'appel a register_chrdev!\n");
-        return majorNumber;
+static int configurerOrdonnancement(struct task_struct *tache){
+    // Applique les paramètres ordonnancement et cpuPolling au thread, avant son démarrage.
+    // sched_setscheduler n'est plus exportée aux modules : sched_setattr_nocheck permet
+    // à la fois de choisir la priorité SCHED_FIFO et de configurer SCHED_DEADLINE.
+    struct sched_attr attributs = { .size = sizeof(attributs) };
+    int choix, ok;
+
+    choix = match_string(nomsOrdonnancements, ARRAY_SIZE(nomsOrdonnancements), ordonnancement);
+    if (choix < 0){
+        printk(KERN_ALERT "SETR_CLAVIER : ordonnancement (%s) doit etre normal, fifo ou deadline!\n", ordonnancement);
+        return -EINVAL;
     }
 
-    // Création de la classe de périphérique
-    setrClasse = class_create(THIS_MODULE, CLS_NAME);
-    if (IS_ERR(setrClasse)){
-        unregister_chrdev(majorNumber, DEV_NAME);
-        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation de la classe de peripherique\n");
-        return PTR_ERR(setrClasse);
+    if (cpuPolling >= 0){
+        if (choix == 2 || cpuPolling >= nr_cpu_ids || !cpu_online(cpuPolling)){
+            printk(KERN_ALERT "SETR_CLAVIER : cpuPolling (%d) doit etre un processeur en ligne, et n'est pas permis avec deadline!\n",
+                   cpuPolling);
+            return -EINVAL;
+        }
+        kthread_bind(tache, cpuPolling);
     }
 
-    // Création du pilote de périphérique associé
-    setrDevice = device_create(setrClasse, NULL, MKDEV(majorNumber, 0), NULL, DEV_NAME);
-    if (IS_ERR(setrDevice)){
-        class_destroy(setrClasse);
-        unregister_chrdev(majorNumber, DEV_NAME);
-        printk(KERN_ALERT "SETR_CLAVIER : Erreur lors de la creation du pilote de peripherique\n");
-        return PTR_ERR(setrDevice);
+    switch(choix){
+    case 1:
+        if (prioriteFifo < 1 || prioriteFifo > MAX_RT_PRIO - 1){
+            printk(KERN_ALERT "SETR_CLAVIER : prioriteFifo (%u) doit etre entre 1 et %d!\n", prioriteFifo, MAX_RT_PRIO - 1);
+            return -EINVAL;
+        }
+        attributs.sched_policy = SCHED_FIFO;
+        attributs.sched_priority = prioriteFifo;
+        break;
+    case 2:
+        attributs.sched_policy = SCHED_DEADLINE;
+        attributs.sched_runtime = (u64)runtimeDeadlineUs * NSEC_PER_USEC;
+        attributs.sched_deadline = attributs.sched_period = (u64)periodeDeadlineUs * NSEC_PER_USEC;
+        break;
+    default:
+        return 0;
     }
 
-    // TODO
-    // Initialisez les GPIO. Pour ce faire, vous DEVEZ utiliser l'API "GPIO Descriptor Consumer Interface"
-    // https://www.kernel.org/doc/html/v6.1/driver-api/gpio/consumer.html
-    //
-    // Plus précisément, dans l'initialisation, vous devrez:
-    // 1) Utiliser gpiod_add_lookup_table pour enregistrer la table de correspondances
-    //      définie dans gpios_table (plus haut)
-    // 2) Appeler 2 fois gpiod_get_array (une fois pour les GPIO en lecture, une fois pour ceux en écriture)
-    //      et mettre le résultat dans gpioLecture et gpioEcriture (déclarés plus haut). Validez que les
-    //      appels de fonction réussissent en utilisant la macro IS_ERR().
-    //      N'oubliez pas de leur donner la bonne direction!
-    //
-    // Vous devez également initialiser le mutex de synchronisation.
-
-
+    // Le noyau vérifie lui-même les valeurs (par exemple runtime <= periode, et la bande
+    // passante SCHED_DEADLINE encore disponible)
+    ok = sched_setattr_nocheck(tache, &attributs);
+    if (ok)
+        printk(KERN_ALERT "SETR_CLAVIER : Erreur (%d) lors du choix de l'ordonnancement %s\n", ok, ordonnancement);
+    return ok;
+}
 
-    // Le mutex devrait avoir été initialisé avant d'appeler la ligne suivante!
-    task = kthread_run(pollClavier, NULL, "Thread_polling_clavier");
+int demarrerPolling(void){
+    // Lance le thread commun à tous les claviers; il dort tant qu'aucun n'a été ajouté.
+    // Il est créé arrêté, pour que son ordonnancement soit en place avant son premier tour.
+    int ok;
 
-    printk(KERN_INFO "SETR_CLAVIER : Fin de l'Initialisation!\n"); // Made it! device was initialized
+    if (periodeMaxUs == 0){
+        periodeMaxUs = pausePollingMs * USEC_PER_MSEC;
+        periodeMinUs = min(periodeMinUs, periodeMaxUs);
+    }
+    if (periodeMinUs == 0 || periodeMaxUs < periodeMinUs){
+        printk(KERN_ALERT "SETR_CLAVIER : pausePollingMs et periodeMinUs doivent etre non nulles, et periodeMinUs inferieure ou egale a periodeMaxUs!\n");
+        return -EINVAL;
+    }
 
+    task = kthread_create(pollClavier, NULL, "Thread_polling_clavier");
+    if (IS_ERR(task))
+        return PTR_ERR(task);
+    ok = configurerOrdonnancement(task);
+    if (ok){
+        // Un thread qui n'a jamais été réveillé peut quand même être arrêté : pollClavier
+        // n'est alors jamais exécutée
+        kthread_stop(task);
+        return ok;
+    }
+    wake_up_process(task);
     return 0;
 }
 
-
-static void __exit setrclavier_exit(void){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-
-    // On arrête le thread de lecture
+void arreterPolling(void){
     kthread_stop(task);
-
-    // TODO
-    // Écrivez le code permettant de relâcher (libérer) les GPIO
-    // N'oubliez pas également de retirer la table de correspondances avec
-    // gpiod_remove_lookup_table
-
-    // On retire correctement les différentes composantes du pilote
-    device_destroy(setrClasse, MKDEV(majorNumber, 0));
-    class_destroy(setrClasse);
-    unregister_chrdev(majorNumber, DEV_NAME);
-    printk(KERN_INFO "SETR_CLAVIER : Terminaison du driver\n");
 }
 
-
-
-
-static int dev_open(struct inode *inodep, struct file *filep){
-    printk(KERN_INFO "SETR_CLAVIER : Ouverture!\n");
-    // Rien à faire ici, si ce n'est retourner une valeur de succès
-    return 0;
-}
-static int dev_release(struct inode *inodep, struct file *filep){
-   printk(KERN_INFO "SETR_CLAVIER : Fermeture!\n");
-   // Rien à faire ici, si ce n'est retourner une valeur de succès
-   return 0;
+void ajouterPolling(struct setrClavier *clavier){
+    // Confie un clavier au thread, qui le balaye aussitôt (en mode hybride, au cas où
+    // une touche aurait été enfoncée avant l'enregistrement des interruptions)
+    clavier->periodeNs = (u64)periodeMinUs * NSEC_PER_USEC;
+    clavier->echeance = clavier->derniereActivite = ktime_get();
+    clavier->balayagesLibres = 0;
+    clavier->enAttenteIrq = false;
+
+    mutex_lock(&verrouClaviers);
+    list_add_tail(&clavier->lienPolling, &listeClaviers);
+    mutex_unlock(&verrouClaviers);
+    WRITE_ONCE(reveilDemande, true);
+    wake_up_process(task);
 }
 
-static ssize_t dev_read(struct file *filep, char *buffer, size_t len, loff_t *offset){
-    // TODO
-    // Déclarez _toutes_ vos variables locales ici (le module est compilé avec un standard générant
-    // un warning si une variable est déclarée après toute ligne de code)
-
-    // TODO
-    // Implémentez cette fonction de lecture
-    // Celle-ci doit copier N caractères dans le buffer fourni en paramètre, N étant le minimum
-    // entre le nombre d'octets disponibles dans le buffer et le nombre d'octets demandés (paramètre len).
-    // Cette fonction DOIT se synchroniser au reste du module avec le mutex.
-    // N'oubliez pas d'utiliser copy_to_user et NON memcpy pour copier les données dans le buffer
-    // de l'utilisateur!
-    // Finalement, rappelez-vous que nous utilisons un buffer circulaire, c'est à dire que les nouvelles
-    // écritures se font sur des adresses croissantes, jusqu'à ce qu'on arrive à la fin du buffer et qu'on
-    // revienne alors à 0. Il est donc tout à fait possible que posCouranteEcriture soit INFÉRIEUR à
-    // posCouranteLecture, et vous devez gérer ce cas sans perdre de caractères et en respectant les
-    // autres conditions (par exemple, ne jamais copier plus que len caractères).
+void retirerPolling(struct setrClavier *clavier){
+    // Le thread détient verrouClaviers pendant ses balayages : une fois retiré,
+    // le clavier n'est plus jamais touché par le thread.
+    mutex_lock(&verrouClaviers);
+    list_del(&clavier->lienPolling);
+    mutex_unlock(&verrouClaviers);
+}
 
+void verrouillerPolling(void){
+    // Le thread détient verrouClaviers pendant ses balayages : tant qu'il est pris, aucun
+    // clavier n'est balayé (voir verrouillerProducteur, setr_driver_core.c)
+    mutex_lock(&verrouClaviers);
 }
 
-// On enregistre les fonctions d'initialisation et de destruction
-module_init(setrclavier_init);
-module_exit(setrclavier_exit);
+void deverrouillerPolling(void){
+    mutex_unlock(&verrouClaviers);
+}
 
-// Description du module
-MODULE_LICENSE("GPL");            // Licence : laissez "GPL"
-MODULE_AUTHOR("Vous!");           // Vos noms
-MODULE_DESCRIPTION("Lecteur de clavier externe par polling");  // Description du module
-MODULE_VERSION("2.0");            // Numéro de version
+void reveillerPolling(struct setrClavier *clavier){
+    // Appelée par setr_irq_handler (contexte d'interruption) en mode hybride, une fois
+    // les interruptions des colonnes de ce clavier masquées. wake_up_process n'utilise que
+    // des verrous "raw", et peut donc être appelée en contexte d'interruption même avec PREEMPT_RT.
+    // Le drapeau du clavier doit être visible avant le drapeau commun (voir pollClavier).
+    WRITE_ONCE(clavier->reveilDemande, true);
+    smp_wmb();
+    WRITE_ONCE(reveilDemande, true);
+    wake_up_process(task);
+}